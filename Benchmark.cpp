@@ -0,0 +1,244 @@
+#include <stdio.h>
+#include <string.h>
+#include "Platform.h"
+#include "ConfigSession.h"
+#include "Image.h"
+#include "Benchmark.h"
+
+const char* gBenchPhaseNames[BENCH_PHASES] = { "erase", "program", "verify", "read" };
+
+struct BenchResult
+{
+	u8 phase;
+	u8 readMode;				// verify and read only
+	bool bOk;
+	u64 elapsedUs;				// session time, virtual on the emulator
+	u64 hostUs;
+	TransportCounters counters;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Defaults, 64KB and 1MB at 15Mhz in each explicit read mode
+////////////////////////////////////////////////////////////////////////////////
+
+void BenchDefaults(BenchConfig* pConfig)
+{
+	pConfig->sizes[0] = 0x10000;
+	pConfig->sizes[1] = 0x100000;
+	pConfig->nSizes = 2;
+	pConfig->clocks[0] = SPI_15MHZ;
+	pConfig->nClocks = 1;
+	pConfig->readModes[0] = READ_MODE_NORMAL;
+	pConfig->readModes[1] = READ_MODE_FAST;
+	pConfig->readModes[2] = READ_MODE_DUAL;
+	pConfig->nReadModes = 3;
+	pConfig->bClockCache = true;
+	pConfig->pOutput = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Test pattern, pseudo random so no page is skipped as blank
+////////////////////////////////////////////////////////////////////////////////
+
+static void BenchPattern(Image* pImage, u32 nSize)
+{
+	pImage->pData = new u8[nSize];
+	pImage->nAddress = BENCH_ADDRESS;
+	pImage->nSize = nSize;
+	pImage->nFormat = IMAGE_FORMAT_BIN;
+	pImage->nRegions = 0;
+	ImageAddRegion(pImage, 0, nSize);
+
+	u32 x = BENCH_PATTERN_SEED;
+	for (u32 n = 0; n < nSize; n++)
+	{
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		pImage->pData[n] = (u8)x;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Time one phase, counting the USB traffic and status polling it takes
+////////////////////////////////////////////////////////////////////////////////
+
+static void BenchPhase(ConfigSession* pSession, const Image* pImage, u8 phase, u8 readMode, u8* pScratch, BenchResult* pResult)
+{
+	pSession->SetReadMode(readMode);
+	pSession->ResetCounters();
+	const u64 hostStart = TimeMicroseconds();
+	const u64 start = pSession->Now();
+
+	bool bOk = false;
+	switch (phase)
+	{
+		case BENCH_PHASE_ERASE:		bOk = pSession->EraseArea(pImage->nAddress, pImage->nSize); break;
+		case BENCH_PHASE_PROGRAM:	bOk = pSession->ProgramPages(pImage); break;
+		case BENCH_PHASE_VERIFY:	bOk = pSession->VerifyImage(pImage); break;
+		case BENCH_PHASE_READ:
+			bOk = pSession->ReadBytes(pImage->nAddress, pScratch, pImage->nSize) &&
+				memcmp(pScratch, pImage->pData, pImage->nSize) == 0;
+			break;
+	}
+	bOk = pSession->Flush() && bOk;
+
+	pResult->phase = phase;
+	pResult->readMode = pSession->ReadMode();
+	pResult->bOk = bOk;
+	pResult->elapsedUs = pSession->Now() - start;
+	pResult->hostUs = TimeMicroseconds() - hostStart;
+	pResult->counters = pSession->Counters();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// JSON output
+////////////////////////////////////////////////////////////////////////////////
+
+static void BenchString(FILE* f, const char* p)
+{
+	fputc('"', f);
+	for (; *p; p++)
+	{
+		if (*p == '"' || *p == '\\') fprintf(f, "\\%c", *p);
+		else if ((u8)*p < 0x20) fprintf(f, "\\u%04x", (u8)*p);
+		else fputc(*p, f);
+	}
+	fputc('"', f);
+}
+
+static void BenchWriteResult(FILE* f, const BenchResult* r, u32 nClockHz, u32 nSize, bool bFirst)
+{
+	const TransportCounters* c = &r->counters;
+	const u64 transactions = c->nWrites + c->nReads;
+	const bool bReadPhase = r->phase == BENCH_PHASE_VERIFY || r->phase == BENCH_PHASE_READ;
+
+	fprintf(f, "%s\n    {\"clockHz\": %u, \"sizeBytes\": %u, \"phase\": ", bFirst ? "" : ",", nClockHz, nSize);
+	BenchString(f, gBenchPhaseNames[r->phase]);
+	fprintf(f, ", \"readMode\": ");
+	if (bReadPhase) BenchString(f, gReadModeNames[r->readMode]);
+	else fprintf(f, "null");
+	fprintf(f, ", \"ok\": %s, \"sessionUs\": %llu, \"hostUs\": %llu, \"MBps\": %.3f",
+		r->bOk ? "true" : "false", (unsigned long long)r->elapsedUs, (unsigned long long)r->hostUs,
+		r->elapsedUs ? (double)nSize / r->elapsedUs : 0.0);
+	fprintf(f, ", \"usbTransactions\": %llu, \"usbTransactionsPerKB\": %.3f, \"usbWriteBytes\": %llu, \"usbReadBytes\": %llu",
+		(unsigned long long)transactions, nSize ? (double)transactions * 1024 / nSize : 0.0,
+		(unsigned long long)c->nWriteBytes, (unsigned long long)c->nReadBytes);
+	fprintf(f, ", \"polls\": %llu, \"delays\": %llu, \"delayMs\": %llu, \"resends\": %llu",
+		(unsigned long long)c->nPolls, (unsigned long long)c->nDelays, (unsigned long long)c->nDelayMs, (unsigned long long)c->nResends);
+	fprintf(f, ", \"pageUs\": ");
+	if (r->phase == BENCH_PHASE_PROGRAM) fprintf(f, "%.1f", (double)r->elapsedUs * 256 / nSize);
+	else fprintf(f, "null");
+	fprintf(f, "}");
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Run every size at every clock, the flash is overwritten from BENCH_ADDRESS
+////////////////////////////////////////////////////////////////////////////////
+
+bool Benchmark(const BenchConfig* pConfig, u8 nBackend, const char* pBackendOption, const TransportProfile* pProfile)
+{
+	FILE* f = stdout;
+	if (pConfig->pOutput && fopen_s(&f, pConfig->pOutput, "wt") != 0)
+	{
+		printf("Unable to write %s.\n", pConfig->pOutput);
+		return false;
+	}
+	const bool bProgress = f != stdout;
+
+	// progress is ours to report, the JSON may be going to stdout
+	ConfigSession session;
+	session.SetQuiet(true);
+	session.SetBackend(nBackend, pBackendOption);
+	session.SetTransport(*pProfile);
+	if (!session.Init(AUTOCLOCK_SAFE_FREQUENCY))
+	{
+		if (f != stdout) fclose(f);
+		return false;
+	}
+	session.WakeUp();
+	session.Reset();
+	session.Identify();
+
+	const TransportProfile& profile = session.Profile();
+	fprintf(f, "{\n  \"tool\": \"TrionFTDI\",\n  \"backend\": ");
+	BenchString(f, gBackendNames[nBackend]);
+	fprintf(f, ",\n  \"serial\": ");
+	BenchString(f, session.Serial());
+	fprintf(f, ",\n  \"device\": ");
+	BenchString(f, session.Device()->pName);
+	fprintf(f, ",\n  \"transport\": {\"latencyMs\": %u, \"readChunk\": %u, \"writeChunk\": %u},\n  \"results\": [",
+		profile.latencyMs, profile.readChunk, profile.writeChunk);
+
+	u32 maxSize = 0;
+	for (u32 n = 0; n < pConfig->nSizes; n++)
+	{
+		if (pConfig->sizes[n] > maxSize) maxSize = pConfig->sizes[n];
+	}
+	u8* scratch = new u8[maxSize ? maxSize : 1];
+
+	bool bOk = true;
+	bool bFirst = true;
+	for (u32 c = 0; c < pConfig->nClocks; c++)
+	{
+		if (pConfig->clocks[c] == SPI_AUTO)
+		{
+			session.SetFrequency(AUTOCLOCK_SAFE_FREQUENCY);
+			session.AutoFrequency(pConfig->bClockCache);
+		}
+		else
+		{
+			session.SetFrequency(pConfig->clocks[c]);
+		}
+		const u32 clockHz = session.Clock().nFrequency;
+
+		for (u32 s = 0; s < pConfig->nSizes; s++)
+		{
+			const u32 size = pConfig->sizes[s];
+			if (size == 0 || BENCH_ADDRESS + size > session.Device()->nSize)
+			{
+				if (bProgress) printf("  %.3fMhz  %6dKB  too big for %s config flash, skipped\n", clockHz / 1000000.0, size / 1024, session.Device()->pName);
+				continue;
+			}
+
+			Image image;
+			BenchPattern(&image, size);
+
+			// erase and program once, verify and read in every mode
+			for (u32 p = 0; p < BENCH_PHASES; p++)
+			{
+				const bool bReadPhase = p == BENCH_PHASE_VERIFY || p == BENCH_PHASE_READ;
+				const u32 nModes = bReadPhase ? pConfig->nReadModes : 1;
+				for (u32 m = 0; m < nModes; m++)
+				{
+					BenchResult result;
+					BenchPhase(&session, &image, (u8)p, bReadPhase ? pConfig->readModes[m] : READ_MODE_AUTO, scratch, &result);
+					BenchWriteResult(f, &result, clockHz, size, bFirst);
+					bFirst = false;
+					bOk &= result.bOk;
+
+					if (bProgress)
+					{
+						printf("  %.3fMhz  %6dKB  %-7s %-6s  %s  %8.2fMB/s  %6.2f USB/KB  %6llu polls", clockHz / 1000000.0, size / 1024,
+							gBenchPhaseNames[p], bReadPhase ? gReadModeNames[result.readMode] : "", result.bOk ? "OK!    " : "FAILED!",
+							result.elapsedUs ? (double)size / result.elapsedUs : 0.0,
+							(double)(result.counters.nWrites + result.counters.nReads) * 1024 / size,
+							(unsigned long long)result.counters.nPolls);
+						if (p == BENCH_PHASE_PROGRAM) printf("  %7.1fus/page  %llu resent", (double)result.elapsedUs * 256 / size, (unsigned long long)result.counters.nResends);
+						printf("\n");
+					}
+				}
+			}
+
+			ImageFree(&image);
+		}
+	}
+
+	fprintf(f, "\n  ]\n}\n");
+	if (f != stdout) fclose(f);
+
+	delete[] scratch;
+	session.Idle();
+	session.Term();
+	return bOk;
+}
@@ -0,0 +1,43 @@
+#ifndef _BENCHMARK_H_
+#define _BENCHMARK_H_
+
+#include "Types.h"
+#include "Transport.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Session benchmark
+// Erases, programs, verifies and reads back a test pattern at each size and
+// SPI clock asked for, verify and read once per read mode, and reports each
+// phase as JSON so runs can be compared between builds and transport
+// profiles. Run on the emulator the times are its virtual time, so results
+// only change when the command stream does.
+////////////////////////////////////////////////////////////////////////////////
+
+#define BENCH_MAX_VALUES		8			// per list
+#define BENCH_ADDRESS			0			// where the pattern is written
+#define BENCH_PATTERN_SEED		0x2545f491
+
+#define BENCH_PHASE_ERASE		0
+#define BENCH_PHASE_PROGRAM		1
+#define BENCH_PHASE_VERIFY		2
+#define BENCH_PHASE_READ		3
+#define BENCH_PHASES			4
+
+extern const char* gBenchPhaseNames[BENCH_PHASES];
+
+struct BenchConfig
+{
+	u32 sizes[BENCH_MAX_VALUES];			// bytes
+	u32 nSizes;
+	u32 clocks[BENCH_MAX_VALUES];			// kHz, or SPI_AUTO
+	u32 nClocks;
+	u8 readModes[BENCH_MAX_VALUES];
+	u32 nReadModes;
+	bool bClockCache;						// for SPI_AUTO
+	const char* pOutput;					// JSON file, stdout if none
+};
+
+void BenchDefaults(BenchConfig* pConfig);
+bool Benchmark(const BenchConfig* pConfig, u8 nBackend, const char* pBackendOption, const TransportProfile* pProfile);
+
+#endif // _BENCHMARK_H_
@@ -0,0 +1,2198 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <mutex>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define HAVE_SSE2
+#endif
+#include "Platform.h"
+#include "MPSSE.h"
+#include "ConfigSession.h"
+#include "Image.h"
+#include "Trace.h"
+
+#pragma warning(disable:4302)
+
+////////////////////////////////////////////////////////////////////////////////
+// Flash devices we know about
+////////////////////////////////////////////////////////////////////////////////
+
+const FlashDevice gFlashDevices[] =
+{
+	{
+		0x13c8, "GigaDevices GD25Q80E", 0x100000,
+		{
+			{ CMD_PROGRAM_PAGE,				600,		2400 },
+			{ CMD_WRITE_STATUS_REGISTERS,	2000,		15000 },
+			{ CMD_SECTOR_ERASE,				50000,		400000 },
+			{ CMD_BLOCK_ERASE_32K,			150000,		800000 },
+			{ CMD_BLOCK_ERASE_64K,			250000,		1200000 },
+			{ CMD_CHIP_ERASE,				3000000,	8000000 },
+		}
+	},
+};
+
+// used for anything we don't recognise, generous enough for most parts
+const FlashDevice gFlashDeviceUnknown =
+{
+	0xffff, "Unknown", READ_MAX_SIZE,
+	{
+		{ CMD_PROGRAM_PAGE,				700,		5000 },
+		{ CMD_WRITE_STATUS_REGISTERS,	5000,		30000 },
+		{ CMD_SECTOR_ERASE,				60000,		500000 },
+		{ CMD_BLOCK_ERASE_32K,			200000,		1600000 },
+		{ CMD_BLOCK_ERASE_64K,			300000,		2000000 },
+		{ CMD_CHIP_ERASE,				5000000,	30000000 },
+	}
+};
+
+const char* gReadModeNames[READ_MODES] = { "auto", "normal", "fast", "dual" };
+
+// tried by TuneTransport
+static const u8 gTuneLatencies[] = { 1, 2, 4, 16 };
+static const u32 gTuneChunks[] = { 4096, 16384, 65536 };
+
+////////////////////////////////////////////////////////////////////////////////
+// Config session
+////////////////////////////////////////////////////////////////////////////////
+
+ConfigSession::ConfigSession()
+	: m_pTransport(0)
+	, m_nBackend(BACKEND_FTDI)
+	, m_pBackendOption(0)
+	, m_pCaptureFile(0)
+	, m_transport(0)
+	, m_nTransportNext(0)
+	, m_profile(gDefaultTransport)
+	, m_pStats(0)
+	, m_nGPIO(CA_CRESET_N | CA_SS_N)
+	, m_nSPIFrequency(SPI_10MHZ)
+	, m_nReadMode(READ_MODE_AUTO)
+	, m_pDevice(0)
+	, m_bQuiet(false)
+{
+	m_clock = MPSSEPlanClock(SPI_10MHZ * 1000);
+	m_serial[0] = 0;
+	ResetCounters();
+	LoadTiming(&gFlashDeviceUnknown);
+}
+
+ConfigSession::~ConfigSession()
+{
+	Term();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Progress output, suppressed when running quietly (e.g. one of many boards)
+////////////////////////////////////////////////////////////////////////////////
+
+void ConfigSession::Progress(const char* pFormat, ...)
+{
+	if (!m_bQuiet)
+	{
+		va_list args;
+		va_start(args, pFormat);
+		vprintf(pFormat, args);
+		va_end(args);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Find all attached adapters
+////////////////////////////////////////////////////////////////////////////////
+
+u32 ConfigSession::FindAdapters(AdapterInfo* pList, u32 nMax)
+{
+	return FTDITransport::FindAdapters(pList, nMax);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Choose what Init opens, a real adapter or the emulator (where the option is
+// the file holding the emulated flash)
+////////////////////////////////////////////////////////////////////////////////
+
+void ConfigSession::SetBackend(u8 nBackend, const char* pOption)
+{
+	m_nBackend = nBackend;
+	m_pBackendOption = pOption;
+}
+
+// record everything sent and received to a trace file, see Trace.h
+void ConfigSession::SetCapture(const char* pFilename)
+{
+	m_pCaptureFile = pFilename;
+}
+
+u64 ConfigSession::Now()
+{
+	return m_pTransport ? m_pTransport->Now() : TimeMicroseconds();
+}
+
+void ConfigSession::Delay(u32 ms)
+{
+	const u64 start = m_pStats ? Now() : 0;
+	m_pTransport->Delay(ms);
+	m_counters.nDelays++;
+	m_counters.nDelayMs += ms;
+	if (m_pStats) StatsIO(m_pStats, STAT_IO_SLEEP, 0, Now() - start);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Statistics scope, image decoding is host work so is always on the host clock
+////////////////////////////////////////////////////////////////////////////////
+
+StatScope::StatScope(ConfigSession* pSession, u8 op)
+	: m_pSession(pSession)
+	, m_pStats(pSession->Stats())
+	, m_nOp(op)
+	, m_nPrevious(0)
+	, m_start(0)
+{
+	// nested calls of the same operation are counted once
+	if (m_pStats && m_pStats->nCurrent == op)
+	{
+		m_pStats = 0;
+	}
+
+	if (m_pStats)
+	{
+		m_nPrevious = m_pStats->nCurrent;
+		m_pStats->nCurrent = op;
+		m_start = Now();
+	}
+}
+
+StatScope::~StatScope()
+{
+	if (m_pStats)
+	{
+		StatsAdd(&m_pStats->ops[m_nOp].calls, Now() - m_start);
+		m_pStats->nCurrent = m_nPrevious;
+	}
+}
+
+u64 StatScope::Now()
+{
+	return m_nOp == STAT_OP_IMAGE ? TimeMicroseconds() : m_pSession->Now();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Asynchronous transport
+// Writes are copied into one of a ring of buffers and submitted without
+// waiting, so several transfers can be in flight at once and the USB pipe
+// stays full. We only block when a buffer comes round again, or on reads.
+////////////////////////////////////////////////////////////////////////////////
+
+bool ConfigSession::TransportWait(TransportBuffer* t)
+{
+	if (!t->tc)
+	{
+		return true;
+	}
+
+	const u64 start = m_pStats ? Now() : 0;
+	const s32 ret = m_pTransport->Wait(t->tc);
+	if (m_pStats) StatsIOFor(m_pStats, t->nStatOp, STAT_IO_WRITE, t->size, Now() - start);
+	t->tc = 0;
+	return ret == t->size;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Transport profile, stored for Init or applied straight away if open
+////////////////////////////////////////////////////////////////////////////////
+
+bool ConfigSession::SetTransport(const TransportProfile& profile)
+{
+	m_profile = profile;
+	if (m_profile.latencyMs < 1) m_profile.latencyMs = 1;
+	if (m_profile.readChunk < 512) m_profile.readChunk = 512;
+	if (m_profile.writeChunk < 512) m_profile.writeChunk = 512;
+	if (m_profile.writeChunk > TRANSPORT_BUFFER_SIZE) m_profile.writeChunk = TRANSPORT_BUFFER_SIZE;
+	return m_pTransport ? ApplyTransport() : true;
+}
+
+bool ConfigSession::ApplyTransport()
+{
+	return	Flush() &&
+			m_pTransport->Configure(m_profile);
+}
+
+void ConfigSession::ResetCounters()
+{
+	memset(&m_counters, 0, sizeof(m_counters));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Queue data to write
+////////////////////////////////////////////////////////////////////////////////
+
+bool ConfigSession::Write(const void* pData, u32 nSize)
+{
+	const u8* ptr = (const u8*)pData;
+	while (nSize)
+	{
+		// wait for the oldest transfer if it is still going
+		TransportBuffer* t = &m_transport[m_nTransportNext];
+		if (!TransportWait(t))
+		{
+			return false;
+		}
+
+		const u32 chunk = nSize < m_profile.writeChunk ? nSize : m_profile.writeChunk;
+		memcpy(t->data, ptr, chunk);
+		t->size = chunk;
+		t->nStatOp = m_pStats ? m_pStats->nCurrent : STAT_OP_OTHER;
+		if ((t->tc = m_pTransport->WriteSubmit(t->data, chunk)) == 0)
+		{
+			return false;
+		}
+		m_counters.nWrites++;
+		m_counters.nWriteBytes += chunk;
+
+		m_nTransportNext = (m_nTransportNext + 1) % TRANSPORT_BUFFERS;
+		ptr += chunk;
+		nSize -= chunk;
+	}
+
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Wait for all writes to complete
+////////////////////////////////////////////////////////////////////////////////
+
+bool ConfigSession::Flush()
+{
+	bool bOk = true;
+	for (u32 n = 0; m_transport && n < TRANSPORT_BUFFERS; n++)
+	{
+		bOk &= TransportWait(&m_transport[n]);
+	}
+	return bOk;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Read data back from the MPSSE, either submitting and waiting separately so
+// the host can get on with something else, or in one go
+////////////////////////////////////////////////////////////////////////////////
+
+TransportRequest* ConfigSession::ReadSubmit(void* pInData, const u32 nLength)
+{
+	m_counters.nReads++;
+	m_counters.nReadBytes += nLength;
+	return m_pTransport->ReadSubmit(pInData, nLength);
+}
+
+bool ConfigSession::ReadWait(TransportRequest* tc, const u32 nLength)
+{
+	if (!tc)
+	{
+		return false;
+	}
+
+	const u64 start = m_pStats ? Now() : 0;
+	const s32 ret = m_pTransport->Wait(tc);
+	if (m_pStats) StatsIO(m_pStats, STAT_IO_READ, nLength, Now() - start);
+	return ret == (s32)nLength;
+}
+
+bool ConfigSession::ReadData(void *pInData, const u32 nLength)
+{
+	return ReadWait(ReadSubmit(pInData, nLength), nLength);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Terminate and free anything related to the device config
+////////////////////////////////////////////////////////////////////////////////
+
+void ConfigSession::Term()
+{
+	if (m_pTransport)
+	{
+		Flush();
+		m_pTransport->Close();
+		delete m_pTransport;
+		m_pTransport = 0;
+	}
+
+	delete[] m_transport;
+	m_transport = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Set config pins to idle (all in)
+////////////////////////////////////////////////////////////////////////////////
+
+bool ConfigSession::Idle()
+{
+	// commands to set all inputs
+	unsigned char buf[] =
+	{
+		SET_BITS_LOW,				// opcode: set low bits (ADBUS[0-7])
+		CA_SS_N | CA_CRESET_N,		// pin states
+		0							// pin direction, all input
+	};
+	const u32 buflen = sizeof(buf);
+
+	// write the setup to the chip.
+	return Write(buf, buflen);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Set config pins to active
+////////////////////////////////////////////////////////////////////////////////
+
+bool ConfigSession::Control(u8 nBits)
+{
+	// commands to set useful initial state and drive output pins
+	unsigned char buf[] =
+	{
+		SET_BITS_LOW,									// opcode: set low bits (ADBUS[0-7])
+		nBits,											// pin states
+		CA_SS_N | CA_CRESET_N | CA_CDI0 | CA_CCK		// pin output, CRESET, SPI DO, CLK and SS
+	};
+	const u32 buflen = sizeof(buf);
+
+	// write the setup to the chip.
+	return Write(buf, buflen);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Set CRESET_N / SS_N state
+////////////////////////////////////////////////////////////////////////////////
+
+bool ConfigSession::FPGAReset(bool bReset)
+{
+	if (bReset) m_nGPIO &= ~CA_CRESET_N;
+	else m_nGPIO |= CA_CRESET_N;
+	return Control(m_nGPIO);
+}
+
+bool ConfigSession::ChipSelect(bool bSelect)
+{
+	if (bSelect) m_nGPIO &= ~CA_SS_N;
+	else m_nGPIO |= CA_SS_N;
+	return Control(m_nGPIO);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Initialise device config (config EEPROM, reset, etc...)
+////////////////////////////////////////////////////////////////////////////////
+
+bool ConfigSession::Init(u32 frequency, const AdapterInfo* pAdapter)
+{
+	// transfer buffers
+	if (!m_transport)
+	{
+		m_transport = new TransportBuffer[TRANSPORT_BUFFERS];
+		for (u32 n = 0; n < TRANSPORT_BUFFERS; n++)
+		{
+			m_transport[n].tc = 0;
+		}
+		m_nTransportNext = 0;
+	}
+
+	// open either the given adapter or the first we find, in MPSSE mode
+	m_pTransport = TransportCreate(m_nBackend, m_pBackendOption);
+	if (m_pTransport && m_pCaptureFile)
+	{
+		m_pTransport = new CaptureTransport(m_pTransport, m_pCaptureFile);
+	}
+	if (!m_pTransport || !m_pTransport->Open(pAdapter))
+	{
+		delete m_pTransport;
+		m_pTransport = 0;
+		return false;
+	}
+
+	// keep the serial to tell adapters apart
+	if (pAdapter)
+	{
+		strncpy(m_serial, pAdapter->serial, sizeof(m_serial) - 1);
+		m_serial[sizeof(m_serial) - 1] = 0;
+	}
+	else if (!m_pTransport->GetSerial(m_serial, sizeof(m_serial)))
+	{
+		m_serial[0] = 0;
+	}
+
+	if (!ApplyTransport())
+	{
+		fprintf(stderr, "Unable to set FTDI latency timer and chunk sizes.\n");
+	}
+
+	Idle();
+
+	// setup SPI clocking etc...
+	unsigned char buf[] =
+	{
+		DIS_ADAPTIVE,		// opcode: disable adaptive clocking
+		DIS_3_PHASE,		// opcode: disable 3-phase clocking
+	};
+	const u32 buflen = sizeof(buf);
+
+	// write the clocking setup and set to idle
+	if (!(Write(buf, buflen) && SetFrequency(frequency) && Idle()))
+	{
+		Term();
+		fprintf(stderr, "Unable to initalise FTDI device for config.\n");
+		return false;
+	}
+
+	// all setup and not interfering with reset, etc...
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Set SPI clock (kHz), rounding down to the nearest the MPSSE can manage
+////////////////////////////////////////////////////////////////////////////////
+
+bool ConfigSession::SetFrequency(u32 frequency)
+{
+	return SetClock(MPSSEPlanClock(frequency * 1000));
+}
+
+bool ConfigSession::SetClock(const MPSSEClock& clock)
+{
+	MPSSECommands& cmds = Commands();
+	cmds.SetClock(clock);
+	if (!Execute(cmds))
+	{
+		return false;
+	}
+
+	m_clock = clock;
+	m_nSPIFrequency = clock.nFrequency >= 1000 ? clock.nFrequency / 1000 : 1;
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Write SPI data
+////////////////////////////////////////////////////////////////////////////////
+
+bool ConfigSession::WriteSPI(const void *pOutData, const int nLength, void *pInData)
+{
+	if (nLength <= 0)
+	{
+		return nLength == 0;
+	}
+
+	// data supplied, or a repeated character filled in as the stream is built
+	MPSSECommands& cmds = Commands();
+	if (pOutData > (const void*)0xff)
+	{
+		if (pInData) cmds.TransferBytes(pOutData, pInData, nLength);
+		else cmds.WriteBytes(pOutData, nLength);
+	}
+	else
+	{
+		if (pInData) cmds.FillTransferBytes((u8)(size_t)pOutData, pInData, nLength);
+		else cmds.FillBytes((u8)(size_t)pOutData, nLength);
+	}
+
+	return Execute(cmds);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Clock dummy bytes, no data goes over USB either way
+////////////////////////////////////////////////////////////////////////////////
+
+bool ConfigSession::DummySPI(const u32 nLength)
+{
+	MPSSECommands& cmds = Commands();
+	cmds.DummyBytes(nLength);
+	return Execute(cmds);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// MPSSE command sequences
+// Commands() starts a new sequence in the session's arena with the current
+// GPIO state, Execute sends it in one write and reads back any data for it.
+////////////////////////////////////////////////////////////////////////////////
+
+MPSSECommands& ConfigSession::Commands()
+{
+	m_cmds.Begin(m_nGPIO, CA_SS_N | CA_CRESET_N | CA_CDI0 | CA_CCK, CA_SS_N);
+	return m_cmds;
+}
+
+bool ConfigSession::Execute(MPSSECommands& cmds)
+{
+	cmds.SendImmediate();
+	if (!cmds.Ok() || !Write(cmds.Data(), cmds.Size()))
+	{
+		return false;
+	}
+
+	if (cmds.ReadSize())
+	{
+		if (!ReadData(cmds.ReadBuffer(), cmds.ReadSize()))
+		{
+			return false;
+		}
+		cmds.Scatter();
+	}
+
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Write single byte command over SPI
+////////////////////////////////////////////////////////////////////////////////
+
+bool ConfigSession::WriteCommand(u8 cmd)
+{
+	MPSSECommands& cmds = Commands();
+	cmds.Command(cmd);
+	return Execute(cmds);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Write command with data and return data of given size
+////////////////////////////////////////////////////////////////////////////////
+
+bool ConfigSession::WriteCommandWithData(u8 cmd, const void *bufOut, void *bufIn, u32 size)
+{
+	MPSSECommands& cmds = Commands();
+	cmds.CommandWithData(cmd, bufOut, bufIn, size);
+	return Execute(cmds);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Write command with address and return data of given size
+////////////////////////////////////////////////////////////////////////////////
+
+bool ConfigSession::WriteCommandWithAddrAndData(u8 cmd, u32 addr, const void *bufOut, void *bufIn, u32 size)
+{
+	MPSSECommands& cmds = Commands();
+	cmds.CommandWithAddrAndData(cmd, addr, bufOut, bufIn, size);
+	return Execute(cmds);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// 
+////////////////////////////////////////////////////////////////////////////////
+
+bool ConfigSession::Reset()
+{
+	MPSSECommands& cmds = Commands();
+	cmds.Command(CMD_RESET_ENABLE);
+	cmds.Command(CMD_RESET);
+	return Execute(cmds);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Wake up if the EEPROM has been put to sleep (Trion will do this after config)
+//
+////////////////////////////////////////////////////////////////////////////////
+
+bool ConfigSession::WakeUp()
+{
+	return WriteCommand(CMD_WAKE_UP);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Read config device id
+////////////////////////////////////////////////////////////////////////////////
+
+bool ConfigSession::ReadDeviceId(u16 *id)
+{
+	return WriteCommandWithAddrAndData(CMD_READ_DEVICE_ID, 0, 0, id, 2);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Read config device id
+////////////////////////////////////////////////////////////////////////////////
+
+bool ConfigSession::ReadUniqueId(void *uid)
+{
+	// dummy address and byte, then the uid
+	const u8 header[4] = { CMD_READ_UNIQUE_ID, 0, 0, 0 };
+	MPSSECommands& cmds = Commands();
+	cmds.ChipSelect(true);
+	cmds.WriteBytes(header, 4);
+	cmds.DummyBytes(1);
+	cmds.ReadBytes(uid, 16);
+	cmds.ChipSelect(false);
+	return Execute(cmds);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Enable write to chip
+////////////////////////////////////////////////////////////////////////////////
+
+bool ConfigSession::WriteEnable()
+{
+	return WriteCommand(CMD_WRITE_ENABLE);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Flash timing model
+// Typical and maximum times of each busy operation for the known devices. The
+// expected time starts at typical and is refined by what we actually measure.
+////////////////////////////////////////////////////////////////////////////////
+
+const FlashDevice* ConfigSession::FindDevice(u16 id)
+{
+	for (u32 n = 0; n < COUNTOF(gFlashDevices); n++)
+	{
+		if (gFlashDevices[n].id == id)
+		{
+			return &gFlashDevices[n];
+		}
+	}
+	return &gFlashDeviceUnknown;
+}
+
+void ConfigSession::LoadTiming(const FlashDevice* pDevice)
+{
+	m_pDevice = pDevice;
+	for (u32 n = 0; n < FLASH_TIMED_OPS; n++)
+	{
+		m_timing[n].cmd = pDevice->timing[n].cmd;
+		m_timing[n].typUs = pDevice->timing[n].typUs;
+		m_timing[n].maxUs = pDevice->timing[n].maxUs;
+		m_timing[n].expectedUs = pDevice->timing[n].typUs;
+		m_timing[n].count = 0;
+	}
+}
+
+FlashOpState* ConfigSession::GetTiming(u8 cmd)
+{
+	for (u32 n = 0; n < FLASH_TIMED_OPS; n++)
+	{
+		if (m_timing[n].cmd == cmd)
+		{
+			return &m_timing[n];
+		}
+	}
+	return 0;
+}
+
+u32 ConfigSession::ExpectedTime(u8 cmd)
+{
+	FlashOpState* op = GetTiming(cmd);
+	return op ? op->expectedUs : 1000;
+}
+
+// feed a measured time back in, moving the expected time a quarter of the way
+// towards it, bounded so an odd measurement can't throw the schedule
+void ConfigSession::UpdateTiming(u8 cmd, u32 measuredUs)
+{
+	FlashOpState* op = GetTiming(cmd);
+	if (op)
+	{
+		if (measuredUs > op->maxUs) measuredUs = op->maxUs;
+		if (measuredUs < op->typUs / 4) measuredUs = op->typUs / 4;
+		op->expectedUs = (op->expectedUs * 3 + measuredUs) / 4;
+		op->count++;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Poll until operation is complete
+// Sleep through most of the expected time for the operation, then queue
+// bursts of back to back status reads in one transfer and scan them for the
+// first with WIP clear. We give up at twice the worst case from the datasheet.
+// Time already spent on the operation, say by a status burst sent with it,
+// comes off the sleep and counts towards the time measured.
+////////////////////////////////////////////////////////////////////////////////
+
+u32 ConfigSession::PollBurstSize(u32 us)
+{
+	// 8 clocks per status byte
+	u32 bytes = (u32)(((u64)us * m_nSPIFrequency) / 8000);
+	if (bytes < 16) bytes = 16;
+	if (bytes > POLL_MAX_BURST) bytes = POLL_MAX_BURST;
+	return bytes;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool ConfigSession::PollStatusComplete(u8 cmd, u32 nElapsedUs)
+{
+	StatScope scope(this, STAT_OP_POLL_STATUS);
+
+	const u64 start = Now();
+
+	FlashOpState* op = GetTiming(cmd);
+	const u32 expectedUs = op ? op->expectedUs : 1000;
+	const u32 timeoutUs = op ? op->maxUs * 2 : 1000000;
+
+	// sleep most of what is left of the expected time away
+	const u32 leftUs = expectedUs > nElapsedUs ? expectedUs - nElapsedUs : 0;
+	const u32 sleepMs = (leftUs * 3) / 4000;
+	if (sleepMs >= POLL_MIN_SLEEP_MS)
+	{
+		Delay(sleepMs);
+	}
+
+	// then poll tightly, each burst covering a fraction of the expected time
+	const u32 burst = PollBurstSize(expectedUs / 16);
+
+	u8 status[POLL_MAX_BURST];
+	do
+	{
+		MPSSECommands& cmds = Commands();
+		cmds.CommandWithData(CMD_READ_STATUS_REGISTER1, 0, status, burst);
+		if (!Execute(cmds))
+		{
+			return false;
+		}
+		m_counters.nPolls++;
+
+		// status is output continuously, done when any read shows WIP clear
+		for (u32 n = 0; n < burst; n++)
+		{
+			if (!(status[n] & STATUS_IN_PROGRESS))
+			{
+				UpdateTiming(cmd, nElapsedUs + (u32)(Now() - start));
+				return true;
+			}
+		}
+	}
+	while ((Now() - start) < timeoutUs);
+
+	return false;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Get status registers
+////////////////////////////////////////////////////////////////////////////////
+
+bool ConfigSession::GetStatus(u16 *status)
+{
+	MPSSECommands& cmds = Commands();
+	cmds.CommandWithData(CMD_READ_STATUS_REGISTER1, 0, status, 1);
+	cmds.CommandWithData(CMD_READ_STATUS_REGISTER2, 0, ((u8*)status) + 1, 1);
+	return Execute(cmds);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Set status registers
+// Write enable goes out in the same transfer as each of the commands that
+// need it, saving a USB round trip per operation.
+////////////////////////////////////////////////////////////////////////////////
+
+bool ConfigSession::SetStatus(const u16 status)
+{
+	MPSSECommands& cmds = Commands();
+	cmds.Command(CMD_WRITE_ENABLE);
+	cmds.CommandWithData(CMD_WRITE_STATUS_REGISTERS, &status, 0, 2);
+	return	Execute(cmds) &&
+			PollStatusComplete(CMD_WRITE_STATUS_REGISTERS);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Erase whole chip
+////////////////////////////////////////////////////////////////////////////////
+
+bool ConfigSession::EraseAll()
+{
+	StatScope scope(this, STAT_OP_ERASE_CHIP);
+
+	MPSSECommands& cmds = Commands();
+	cmds.Command(CMD_WRITE_ENABLE);
+	cmds.Command(CMD_CHIP_ERASE);
+	return	Execute(cmds) &&
+			PollStatusComplete(CMD_CHIP_ERASE);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Erase sector (4K)
+////////////////////////////////////////////////////////////////////////////////
+
+bool ConfigSession::EraseSector(u32 addr)
+{
+	StatScope scope(this, STAT_OP_ERASE_SECTOR);
+
+	MPSSECommands& cmds = Commands();
+	cmds.Command(CMD_WRITE_ENABLE);
+	cmds.CommandWithAddrAndData(CMD_SECTOR_ERASE, addr, 0, 0, 0);
+	return	Execute(cmds) &&
+			PollStatusComplete(CMD_SECTOR_ERASE);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Erase block (32K/64K)
+////////////////////////////////////////////////////////////////////////////////
+
+bool ConfigSession::EraseBlock32(u32 addr)
+{
+	StatScope scope(this, STAT_OP_ERASE_32K);
+
+	MPSSECommands& cmds = Commands();
+	cmds.Command(CMD_WRITE_ENABLE);
+	cmds.CommandWithAddrAndData(CMD_BLOCK_ERASE_32K, addr, 0, 0, 0);
+	return	Execute(cmds) &&
+			PollStatusComplete(CMD_BLOCK_ERASE_32K);
+}
+
+bool ConfigSession::EraseBlock64(u32 addr)
+{
+	StatScope scope(this, STAT_OP_ERASE_64K);
+
+	MPSSECommands& cmds = Commands();
+	cmds.Command(CMD_WRITE_ENABLE);
+	cmds.CommandWithAddrAndData(CMD_BLOCK_ERASE_64K, addr, 0, 0, 0);
+	return	Execute(cmds) &&
+			PollStatusComplete(CMD_BLOCK_ERASE_64K);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Erase given area
+////////////////////////////////////////////////////////////////////////////////
+
+bool ConfigSession::EraseArea(u32 addr, u32 size)
+{
+	bool bOk = true;
+	
+	// align start address and size to 4K sectors (minimum erase size)
+	size += addr & 4095;
+	addr &= ~4095;
+	size = (size + 4095) & ~4095;
+
+	while (bOk && size)
+	{
+		// aligned to 64K
+		if (((addr & 65535) == 0) && (size >= 65536))
+		{
+			bOk = EraseBlock64(addr);
+			addr += 65536;
+			size -= 65536;
+		}
+		else if (((addr & 32767) == 0) && (size >= 32768))
+		{
+			bOk = EraseBlock32(addr);
+			addr += 32768;
+			size -= 32768;
+		}
+		else
+		{
+			bOk = EraseSector(addr);
+			addr += 4096;
+			size -= 4096;
+		}
+	}
+
+	return bOk;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Erase only the 4K sectors flagged in the mask, runs of adjacent sectors are
+// erased together so they can still use block erases
+////////////////////////////////////////////////////////////////////////////////
+
+bool ConfigSession::EraseSectors(u32 addr, const u8* pMask, u32 nSectors)
+{
+	bool bOk = true;
+	addr &= ~4095;
+
+	u32 n = 0;
+	while (bOk && n < nSectors)
+	{
+		if (!pMask[n])
+		{
+			n++;
+			continue;
+		}
+
+		u32 start = n;
+		while (n < nSectors && pMask[n]) n++;
+		bOk = EraseArea(addr + start * 4096, (n - start) * 4096);
+	}
+
+	return bOk;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Write page (max 256 bytes), data will wrap within 256 byte page, so max
+// sequential write is 256-(addr&255).
+////////////////////////////////////////////////////////////////////////////////
+
+bool ConfigSession::WritePage(u32 nAddress, const void* pData, u32 nSize)
+{
+	StatScope scope(this, STAT_OP_WRITE_PAGE);
+
+	if (nSize > 256)
+	{
+		return false;
+	}
+
+	MPSSECommands& cmds = Commands();
+	cmds.Command(CMD_WRITE_ENABLE);
+	cmds.CommandWithAddrAndData(CMD_PROGRAM_PAGE, nAddress, pData, 0, nSize);
+	return	Execute(cmds) &&
+			PollStatusComplete(CMD_PROGRAM_PAGE);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Check if data is all 0xff (erased state), so there is no need to program it
+////////////////////////////////////////////////////////////////////////////////
+
+bool PageIsBlank(const void* pData, u32 nSize)
+{
+	const u8* ptr = (const u8*)pData;
+
+#ifdef HAVE_SSE2
+	const __m128i ones = _mm_set1_epi8((char)0xff);
+	while (nSize >= 64)
+	{
+		__m128i a = _mm_and_si128(_mm_loadu_si128((const __m128i*)ptr), _mm_loadu_si128((const __m128i*)(ptr + 16)));
+		__m128i b = _mm_and_si128(_mm_loadu_si128((const __m128i*)(ptr + 32)), _mm_loadu_si128((const __m128i*)(ptr + 48)));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(a, b), ones)) != 0xffff)
+		{
+			return false;
+		}
+		ptr += 64;
+		nSize -= 64;
+	}
+#endif
+
+	while (nSize >= 8)
+	{
+		u64 v;
+		memcpy(&v, ptr, 8);
+		if (v != ~0ull)
+		{
+			return false;
+		}
+		ptr += 8;
+		nSize -= 8;
+	}
+
+	while (nSize--)
+	{
+		if (*ptr++ != 0xff)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Pipelined page programming
+// Each page goes out as a single stream (write enable, program page then a
+// burst of status reads sized to cover the expected program time). The next
+// page's stream is written before the burst is read back, so the adapter
+// starts it as soon as the burst ends rather than a USB round trip later.
+// If the burst shows the page still programming, the flash will have ignored
+// the next page's commands, so once it is done the next page is sent again
+// (programming the same data twice changes nothing if it did get in).
+////////////////////////////////////////////////////////////////////////////////
+
+void ConfigSession::PipelineInit(PagePipeline* p)
+{
+	p->nNext = 0;
+	p->bInFlight = false;
+	p->nPollBytes = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Wait for the page in flight to complete
+////////////////////////////////////////////////////////////////////////////////
+
+bool ConfigSession::PipelineComplete(PagePipeline* p)
+{
+	StatScope scope(this, STAT_OP_WRITE_PAGE);
+
+	bool bDone;
+	return	PipelineCollect(p, &bDone) &&
+			(bDone || PollStatusComplete(CMD_PROGRAM_PAGE, (p->nPollBytes * 8000) / m_nSPIFrequency));
+}
+
+// read back the burst of the page in flight, bDone is false if it ended with
+// the page still programming
+bool ConfigSession::PipelineCollect(PagePipeline* p, bool* pDone)
+{
+	*pDone = true;
+	if (!p->bInFlight)
+	{
+		return true;
+	}
+	p->bInFlight = false;
+
+	if (!ReadWait(p->tc, p->nPollBytes))
+	{
+		return false;
+	}
+	m_counters.nPolls++;
+
+	// the status register is output continuously, so look for the first
+	// read that shows the program as complete
+	for (u32 n = 0; n < p->nPollBytes; n++)
+	{
+		if (!(p->status[n] & STATUS_IN_PROGRESS))
+		{
+			// each status byte is 8 clocks, so this tells us how long it took
+			UpdateTiming(CMD_PROGRAM_PAGE, (n * 8000) / m_nSPIFrequency);
+			return true;
+		}
+	}
+
+	*pDone = false;
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Queue a page (max 256 bytes, must not cross a page boundary)
+////////////////////////////////////////////////////////////////////////////////
+
+bool ConfigSession::PipelineWritePage(PagePipeline* p, u32 nAddress, const void* pData, u32 nSize)
+{
+	StatScope scope(this, STAT_OP_WRITE_PAGE);
+
+	if (nSize == 0 || nSize > 256 - (nAddress & 255))
+	{
+		return false;
+	}
+
+	// the burst starts as the program does, so it only has to cover the
+	// expected program time, with a sixteenth to spare as a resend is costly
+	const u32 expectedUs = ExpectedTime(CMD_PROGRAM_PAGE);
+	const u32 nPollBytes = PollBurstSize(expectedUs + expectedUs / 16);
+
+	// build the stream while any previous page programs, the status reads
+	// are collected by ReadSubmit rather than mapped to a buffer
+	MPSSECommands& cmds = p->stream[p->nNext];
+	cmds.Begin(m_nGPIO, CA_SS_N | CA_CRESET_N | CA_CDI0 | CA_CCK, CA_SS_N);
+	cmds.Command(CMD_WRITE_ENABLE);
+	cmds.CommandWithAddrAndData(CMD_PROGRAM_PAGE, nAddress, pData, 0, nSize);
+	const u8 rdsr = CMD_READ_STATUS_REGISTER1;
+	cmds.ChipSelect(true);
+	cmds.WriteBytes(&rdsr, 1);
+	cmds.ReadBytes(0, nPollBytes);
+	cmds.ChipSelect(false);
+	cmds.SendImmediate();
+
+	// queue it behind the previous page's burst, then see how that went
+	bool bDone;
+	if (!Write(cmds.Data(), cmds.Size()) || !PipelineCollect(p, &bDone))
+	{
+		return false;
+	}
+
+	// the previous page outlasted its burst, so this one was ignored. Take
+	// its burst off the adapter, finish polling, and send it again
+	if (!bDone)
+	{
+		if (!ReadData(p->status, nPollBytes) ||
+			!PollStatusComplete(CMD_PROGRAM_PAGE, (p->nPollBytes * 8000) / m_nSPIFrequency) ||
+			!Write(cmds.Data(), cmds.Size()))
+		{
+			return false;
+		}
+		m_counters.nResends++;
+	}
+
+	// and submit the status read so it is collected in the background
+	p->nPollBytes = nPollBytes;
+	if ((p->tc = ReadSubmit(p->status, nPollBytes)) == 0)
+	{
+		return false;
+	}
+
+	p->bInFlight = true;
+	p->nNext ^= 1;
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Read modes
+// Normal read is limited in frequency on many parts, so at higher clocks fast
+// read (with its dummy byte) is used instead. Dual output read has the flash
+// drive both CDI0 and CDI1, which the MPSSE can only sample as GPIO a clock at
+// a time, so it is only worthwhile where USB rather than SPI is the limit.
+////////////////////////////////////////////////////////////////////////////////
+
+u8 ConfigSession::ReadMode()
+{
+	if (m_nReadMode == READ_MODE_AUTO)
+	{
+		return m_nSPIFrequency > READ_NORMAL_MAX_FREQUENCY ? READ_MODE_FAST : READ_MODE_NORMAL;
+	}
+	return m_nReadMode;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Read bytes starting at address given
+// A single read command covers the whole length (the flash keeps streaming
+// until CS goes high), with the clocking split into 64K MPSSE reads that all
+// go out in one transfer. ReadStart only sends the commands, so callers
+// can consume the data with ReadData as it arrives. Dual reads can't be
+// streamed this way as the samples need decoding, see ReadDual.
+////////////////////////////////////////////////////////////////////////////////
+
+bool ConfigSession::ReadCanStream()
+{
+	return ReadMode() != READ_MODE_DUAL;
+}
+
+bool ConfigSession::ReadStart(u32 nAddress, u32 nSize)
+{
+	if (nSize == 0 || nSize > READ_MAX_SIZE || !ReadCanStream())
+	{
+		return false;
+	}
+
+	// fast read has a dummy byte after the address, the data is left for the
+	// caller to collect
+	const bool bFast = ReadMode() == READ_MODE_FAST;
+	u8 header[4] = { (u8)(bFast ? CMD_FAST_READ : CMD_READ_BYTES), (u8)(nAddress >> 16), (u8)(nAddress >> 8), (u8)nAddress };
+	MPSSECommands& cmds = Commands();
+	cmds.ChipSelect(true);
+	cmds.WriteBytes(header, 4);
+	if (bFast) cmds.DummyBytes(1);
+	cmds.ReadBytes(0, nSize);
+	cmds.ChipSelect(false);
+	cmds.SendImmediate();
+	return Write(cmds.Data(), cmds.Size());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Dual output read, CDI0 is released so the flash can drive it, then for each
+// pair of bits the pins are sampled and a single clock is issued
+////////////////////////////////////////////////////////////////////////////////
+
+#define DUAL_CHUNK_SIZE					1024
+
+bool ConfigSession::ReadDual(u32 nAddress, void* pData, u32 nSize)
+{
+	u8* samples = new u8[DUAL_CHUNK_SIZE * 4];
+	u8* out = (u8*)pData;
+
+	bool bOk = true;
+	while (bOk && nSize)
+	{
+		const u32 chunk = nSize < DUAL_CHUNK_SIZE ? nSize : DUAL_CHUNK_SIZE;
+		u8 header[4] = { CMD_DUAL_OUTPUT_READ, (u8)(nAddress >> 16), (u8)(nAddress >> 8), (u8)nAddress };
+		MPSSECommands& cmds = Commands();
+		cmds.ChipSelect(true);
+		cmds.WriteBytes(header, 4);
+		cmds.DummyBytes(1);
+
+		// CS still low, CDI0 now an input
+		cmds.SetPins(m_nGPIO & ~CA_SS_N, CA_SS_N | CA_CRESET_N | CA_CCK);
+
+		for (u32 n = 0; n < chunk * 4; n++)
+		{
+			cmds.GetPins(samples + n);
+			cmds.ClockBits(1);
+		}
+
+		cmds.ChipSelect(false);
+		bOk = Execute(cmds);
+
+		// CDI1 carries the high bit of each pair
+		for (u32 n = 0; bOk && n < chunk; n++)
+		{
+			u8 data = 0;
+			for (u32 bit = 0; bit < 4; bit++)
+			{
+				const u8 pins = samples[n * 4 + bit];
+				data = (data << 2) | ((pins & CA_CDI1) ? 2 : 0) | ((pins & CA_CDI0) ? 1 : 0);
+			}
+			*out++ = data;
+		}
+
+		nAddress += chunk;
+		nSize -= chunk;
+	}
+
+	delete[] samples;
+	return bOk;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool ConfigSession::ReadBytes(u32 nAddress, void* pData, u32 nSize)
+{
+	StatScope scope(this, STAT_OP_READ);
+
+	if (!ReadCanStream())
+	{
+		return ReadDual(nAddress, pData, nSize);
+	}
+
+	return	ReadStart(nAddress, nSize) &&
+			ReadData(pData, nSize);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Throw away the rest of a started read so the next command starts clean
+////////////////////////////////////////////////////////////////////////////////
+
+bool ConfigSession::ReadDiscard(u32 nSize)
+{
+	u8 temp[4096];
+	bool bOk = true;
+	while (bOk && nSize)
+	{
+		const u32 chunk = nSize < sizeof(temp) ? nSize : sizeof(temp);
+		bOk = ReadData(temp, chunk);
+		nSize -= chunk;
+	}
+	return bOk;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Streamed readback, the caller is handed each chunk in turn while the next
+// one is arriving
+////////////////////////////////////////////////////////////////////////////////
+
+bool ConfigSession::ReadStreamSubmit(ReadStream* s)
+{
+	const u32 remaining = s->nTotal - s->nSubmitted;
+	s->size = remaining < READ_STREAM_CHUNK ? remaining : READ_STREAM_CHUNK;
+	s->tc = 0;
+	if (s->size == 0)
+	{
+		return true;
+	}
+
+	s->nSubmitted += s->size;
+	return (s->tc = ReadSubmit(s->buf[s->nSlot], s->size)) != 0;
+}
+
+bool ConfigSession::ReadStreamStart(ReadStream* s, u32 nAddress, u32 nSize)
+{
+	StatScope scope(this, STAT_OP_READ);
+
+	s->nTotal = nSize;
+	s->nSubmitted = 0;
+	s->nSlot = 0;
+	s->tc = 0;
+
+	return	ReadStart(nAddress, nSize) &&
+			ReadStreamSubmit(s);
+}
+
+const u8* ConfigSession::ReadStreamNext(ReadStream* s, u32* pSize)
+{
+	StatScope scope(this, STAT_OP_READ);
+
+	if (!s->tc)
+	{
+		return 0;
+	}
+
+	const bool bOk = ReadWait(s->tc, s->size);
+	s->tc = 0;
+	if (!bOk)
+	{
+		return 0;
+	}
+
+	// the caller is done with the other buffer, so the next chunk goes there
+	const u32 slot = s->nSlot;
+	*pSize = s->size;
+	s->nSlot ^= 1;
+	if (!ReadStreamSubmit(s))
+	{
+		return 0;
+	}
+
+	return s->buf[slot];
+}
+
+void ConfigSession::ReadStreamEnd(ReadStream* s)
+{
+	StatScope scope(this, STAT_OP_READ);
+
+	// collect what is still in flight and throw away what was never asked for
+	if (s->tc)
+	{
+		ReadWait(s->tc, s->size);
+		s->tc = 0;
+	}
+
+	if (s->nSubmitted < s->nTotal)
+	{
+		ReadDiscard(s->nTotal - s->nSubmitted);
+		s->nSubmitted = s->nTotal;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Identify the connected EEPROM and load its timing
+////////////////////////////////////////////////////////////////////////////////
+
+bool ConfigSession::Identify()
+{
+	u16 id = 0xffff;
+	bool bOk = ReadDeviceId(&id);
+	LoadTiming(FindDevice(id));
+	return bOk;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Show info on connected EEPROM
+////////////////////////////////////////////////////////////////////////////////
+
+void ConfigSession::ShowDeviceInfo()
+{
+	u16 id = 0xffff;
+	ReadDeviceId(&id);
+	const char* pDev = FindDevice(id)->pName;
+
+	fprintf(stdout, "Config manufacturer / device ID %04X (%s)\n", id, pDev);
+
+	u8 uid[16];
+	ReadUniqueId(&uid);
+	fprintf(stdout, "Config unique ID ");
+	for (u32 n = 0; n < 16; n++)
+	{
+		fprintf(stdout, "%02X", uid[n]);
+	}
+	fprintf(stdout, "\n");
+
+	u16 status;
+	GetStatus(&status);
+	fprintf(stdout, "Status: %04x (QE: %s)\n", status, status & STATUS_QUAD_ENABLE ? "Yes" : "No");
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Differential programming
+// Read back what is already in the flash and compare it a sector at a time,
+// only the sectors that differ are erased and programmed, and pages that are
+// all 0xff are left as erased. Sectors the image only partly covers are kept
+// as they were read, so what lies outside the image goes back in after the
+// erase.
+////////////////////////////////////////////////////////////////////////////////
+
+#define DIFF_READ_SIZE		65536
+
+bool ConfigSession::ProgramDifferential(const Image* pImage)
+{
+	// sector range covering the image
+	const u32 firstSector = pImage->nAddress & ~4095;
+	const u32 nSectorCount = (((pImage->nAddress + pImage->nSize + 4095) & ~4095) - firstSector) / 4096;
+
+	u8* compared = new u8[nSectorCount];
+	u8* dirty = new u8[nSectorCount];
+	u8* current = new u8[DIFF_READ_SIZE];
+	memset(compared, 0, nSectorCount);
+	memset(dirty, 0, nSectorCount);
+
+	// a region can only part cover its first and last sectors
+	u8* kept = new u8[pImage->nRegions * 2 * 4096];
+	u32* keptSlot = new u32[nSectorCount];
+	u32 nKept = 0;
+	memset(keptSlot, 0xff, nSectorCount * sizeof(u32));
+
+	// read back each region in large chunks and compare it a sector at a time,
+	// only the bytes the image holds count
+	Progress("Comparing ($%x-$%x)... ", pImage->nAddress, pImage->nAddress + pImage->nSize - 1);
+	bool bOk = true;
+	u32 nCompared = 0;
+	u32 nChanged = 0;
+	for (u32 r = 0; bOk && r < pImage->nRegions; r++)
+	{
+		const u32 writeAddr = pImage->nAddress + pImage->regions[r].nOffset;
+		const u32 size = pImage->regions[r].nSize;
+		const u32 regionSector = writeAddr & ~4095;
+		const u32 nSectors = ((writeAddr + size + 4095) & ~4095) - regionSector;
+
+		for (u32 offset = 0; bOk && offset < nSectors; offset += DIFF_READ_SIZE)
+		{
+			const u32 chunk = (nSectors - offset) < DIFF_READ_SIZE ? (nSectors - offset) : DIFF_READ_SIZE;
+			bOk = ReadBytes(regionSector + offset, current, chunk);
+
+			for (u32 sector = 0; bOk && sector < chunk; sector += 4096)
+			{
+				// part of the sector the region covers
+				u32 start = regionSector + offset + sector;
+				u32 end = start + 4096;
+				if (start < writeAddr) start = writeAddr;
+				if (end > writeAddr + size) end = writeAddr + size;
+
+				const u32 index = (regionSector + offset + sector - firstSector) / 4096;
+				if (!compared[index])
+				{
+					compared[index] = 1;
+					nCompared++;
+				}
+				if (end - start < 4096 && keptSlot[index] == ~0u)
+				{
+					keptSlot[index] = nKept;
+					memcpy(kept + nKept++ * 4096, current + sector, 4096);
+				}
+
+				const u8* pNew = pImage->pData + (start - pImage->nAddress);
+				const u8* pOld = current + (start - (regionSector + offset));
+				if (!dirty[index] && memcmp(pNew, pOld, end - start) != 0)
+				{
+					dirty[index] = 1;
+					nChanged++;
+				}
+			}
+		}
+	}
+
+	if (!bOk)
+	{
+		Progress("FAILED!\n");
+	}
+	else
+	{
+		Progress("%d of %d sectors changed.\n", nChanged, nCompared);
+	}
+
+	// erase what has changed
+	if (bOk && nChanged)
+	{
+		Progress("Erasing changed sectors... ");
+		bOk = EraseSectors(firstSector, dirty, nSectorCount);
+		Progress(bOk ? "OK!\n" : "FAILED!\n");
+	}
+
+	// and program the pages within them that aren't blank, each sector being
+	// what was kept of it with the image laid over the top
+	if (bOk && nChanged)
+	{
+		Progress("Programming changed sectors... ");
+
+		PagePipeline* pipeline = new PagePipeline;
+		PipelineInit(pipeline);
+
+		u8 sector[4096];
+		for (u32 index = 0; bOk && index < nSectorCount; index++)
+		{
+			if (!dirty[index])
+			{
+				continue;
+			}
+
+			const u32 sectorAddr = firstSector + index * 4096;
+			if (keptSlot[index] != ~0u) memcpy(sector, kept + keptSlot[index] * 4096, 4096);
+			else memset(sector, 0xff, 4096);
+			for (u32 r = 0; r < pImage->nRegions; r++)
+			{
+				u32 start = pImage->nAddress + pImage->regions[r].nOffset;
+				u32 end = start + pImage->regions[r].nSize;
+				if (start < sectorAddr) start = sectorAddr;
+				if (end > sectorAddr + 4096) end = sectorAddr + 4096;
+				if (start < end) memcpy(sector + (start - sectorAddr), pImage->pData + (start - pImage->nAddress), end - start);
+			}
+
+			for (u32 page = 0; bOk && page < 4096; page += 256)
+			{
+				if (!PageIsBlank(sector + page, 256))
+				{
+					bOk = PipelineWritePage(pipeline, sectorAddr + page, sector + page, 256);
+				}
+			}
+		}
+
+		bOk = PipelineComplete(pipeline) && bOk;
+		delete pipeline;
+
+		Progress(bOk ? "OK!\n" : "FAILED!\n");
+	}
+
+	delete[] keptSlot;
+	delete[] kept;
+	delete[] current;
+	delete[] dirty;
+	delete[] compared;
+	return bOk;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Program the pages of all regions of an image, leaving out blank pages. All
+// regions go through the one pipeline
+////////////////////////////////////////////////////////////////////////////////
+
+static u32 ImageDataSize(const Image* pImage)
+{
+	u32 total = 0;
+	for (u32 r = 0; r < pImage->nRegions; r++) total += pImage->regions[r].nSize;
+	return total;
+}
+
+bool ConfigSession::ProgramPages(const Image* pImage)
+{
+	const u32 total = ImageDataSize(pImage);
+	if (pImage->nRegions == 1) Progress("Programming ($%x-$%x)... ", pImage->nAddress + pImage->regions[0].nOffset, pImage->nAddress + pImage->regions[0].nOffset + total - 1);
+	else Progress("Programming %d regions ($%x-$%x)... ", pImage->nRegions, pImage->nAddress, pImage->nAddress + pImage->nSize - 1);
+
+	PagePipeline* pipeline = new PagePipeline;
+	PipelineInit(pipeline);
+
+	bool bOk = true;
+	s32 percent = -1;
+	u32 nBlankPages = 0;
+	u32 done = 0;
+	for (u32 r = 0; bOk && r < pImage->nRegions; r++)
+	{
+		const u8* pData = pImage->pData + pImage->regions[r].nOffset;
+		const u32 writeAddr = pImage->nAddress + pImage->regions[r].nOffset;
+		const u32 size = pImage->regions[r].nSize;
+
+		u32 offset = 0;
+		while (bOk && offset < size)
+		{
+			// keep within page boundaries
+			const u32 addr = writeAddr + offset;
+			u32 len = 256 - (addr & 255);
+			if (len > size - offset) len = size - offset;
+
+			// blank pages are already in the erased state
+			if (PageIsBlank(pData + offset, len)) nBlankPages++;
+			else bOk = PipelineWritePage(pipeline, addr, pData + offset, len);
+
+			// update progress
+			s32 npercent = (s32)(((u64)(done + offset) * 100) / total);
+			if (npercent != percent)
+			{
+				percent = npercent;
+				Progress("%02d%%\b\b\b", percent);
+			}
+
+			offset += len;
+		}
+		done += size;
+	}
+
+	// wait for the last page to finish
+	bOk = PipelineComplete(pipeline) && bOk;
+	delete pipeline;
+
+	if (!bOk)
+	{
+		Progress("FAILED!\n");
+	}
+	else
+	{
+		Progress("OK!\n");
+		if (nBlankPages)
+		{
+			// each skipped page saves its transfer and program time
+			const u32 pageUs = ExpectedTime(CMD_PROGRAM_PAGE) + (300 * 8000) / m_nSPIFrequency;
+			Progress("Skipped %d blank pages (~%dms saved).\n", nBlankPages, (nBlankPages * pageUs) / 1000);
+		}
+	}
+
+	return bOk;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Verify all regions of an image against the flash
+////////////////////////////////////////////////////////////////////////////////
+
+bool ConfigSession::VerifyImage(const Image* pImage)
+{
+	Progress("Verifying... ");
+
+	// streams each region back in one read where it can
+	const bool bStream = ReadCanStream();
+	ReadStream* stream = bStream ? new ReadStream : 0;
+	const u64 startTime = Now();
+	const u32 total = ImageDataSize(pImage);
+
+	bool bOk = true;
+	s32 percent = -1;
+	u32 done = 0;
+	for (u32 r = 0; bOk && r < pImage->nRegions; r++)
+	{
+		const u8* pExpected = pImage->pData + pImage->regions[r].nOffset;
+		const u32 readAddr = pImage->nAddress + pImage->regions[r].nOffset;
+		const u32 size = pImage->regions[r].nSize;
+
+		bOk = !bStream || ReadStreamStart(stream, readAddr, size);
+
+		u32 offset = 0;
+		while (bOk && offset < size)
+		{
+			u32 len = size - offset < VERIFY_CHUNK_SIZE ? size - offset : VERIFY_CHUNK_SIZE;
+
+			u8 temp[VERIFY_CHUNK_SIZE];
+			const u8* pData = temp;
+			if (bStream)
+			{
+				u32 got = 0;
+				bOk = (pData = ReadStreamNext(stream, &got)) != 0 && got == len;
+			}
+			else
+			{
+				bOk = ReadBytes(readAddr + offset, temp, len);
+			}
+
+			bOk = bOk && memcmp(pExpected + offset, pData, len) == 0;
+
+			// update progress
+			s32 npercent = (s32)(((u64)(done + offset) * 100) / total);
+			if (npercent != percent)
+			{
+				percent = npercent;
+				Progress("%02d%%\b\b\b", percent);
+			}
+
+			offset += len;
+		}
+		done += size;
+
+		// collect anything left of the readback if verify stopped early
+		if (bStream)
+		{
+			ReadStreamEnd(stream);
+		}
+	}
+	delete stream;
+
+	if (bOk)
+	{
+		// show the readback rate, to help pick the read mode
+		const u64 elapsed = Now() - startTime;
+		Progress("OK! (%s read, %.2fMB/s)\n", gReadModeNames[ReadMode()], elapsed ? (double)total / elapsed : 0.0);
+	}
+	else
+	{
+		Progress("FAILED!\n");
+	}
+
+	return bOk;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Erase the sectors under all regions of an image, regions that share or sit
+// in adjacent sectors are erased together so they can use block erases.
+// Sectors the regions only partly cover are read first, and what lies outside
+// the regions is programmed back after the erase, so gaps and neighbouring
+// data survive
+////////////////////////////////////////////////////////////////////////////////
+
+// bytes of the 4K sector at nAddress the image covers, and if pSector holds
+// the sector they are blanked in it
+static u32 ImageSectorCover(const Image* pImage, u32 nAddress, u8* pSector)
+{
+	u32 covered = 0;
+	for (u32 r = 0; r < pImage->nRegions; r++)
+	{
+		u32 start = pImage->nAddress + pImage->regions[r].nOffset;
+		u32 end = start + pImage->regions[r].nSize;
+		if (start < nAddress) start = nAddress;
+		if (end > nAddress + 4096) end = nAddress + 4096;
+		if (start >= end) continue;
+
+		covered += end - start;
+		if (pSector) memset(pSector + (start - nAddress), 0xff, end - start);
+	}
+	return covered;
+}
+
+bool ConfigSession::EraseImage(const Image* pImage)
+{
+	// a region can only part cover its first and last sectors
+	u8* kept = new u8[pImage->nRegions * 2 * 4096];
+	u32* keptAddr = new u32[pImage->nRegions * 2];
+
+	bool bOk = true;
+	u32 r = 0;
+	while (bOk && r < pImage->nRegions)
+	{
+		const u32 start = (pImage->nAddress + pImage->regions[r].nOffset) & ~4095;
+		u32 end = (pImage->nAddress + pImage->regions[r].nOffset + pImage->regions[r].nSize + 4095) & ~4095;
+		for (r++; r < pImage->nRegions; r++)
+		{
+			const u32 nextStart = (pImage->nAddress + pImage->regions[r].nOffset) & ~4095;
+			const u32 nextEnd = (pImage->nAddress + pImage->regions[r].nOffset + pImage->regions[r].nSize + 4095) & ~4095;
+			if (nextStart > end) break;
+			if (nextEnd > end) end = nextEnd;
+		}
+
+		Progress("Erasing ($%x-$%x)... ", start, end - 1);
+
+		// keep what the image doesn't cover
+		u32 nKept = 0;
+		for (u32 sector = start; bOk && sector < end; sector += 4096)
+		{
+			if (ImageSectorCover(pImage, sector, 0) < 4096)
+			{
+				u8* pSector = kept + nKept * 4096;
+				keptAddr[nKept++] = sector;
+				bOk = ReadBytes(sector, pSector, 4096);
+				ImageSectorCover(pImage, sector, pSector);
+			}
+		}
+
+		bOk = bOk && EraseArea(start, end - start);
+
+		// and put it back
+		if (bOk && nKept)
+		{
+			PagePipeline* pipeline = new PagePipeline;
+			PipelineInit(pipeline);
+			for (u32 n = 0; bOk && n < nKept; n++)
+			{
+				for (u32 page = 0; bOk && page < 4096; page += 256)
+				{
+					const u8* pPage = kept + n * 4096 + page;
+					if (!PageIsBlank(pPage, 256)) bOk = PipelineWritePage(pipeline, keptAddr[n] + page, pPage, 256);
+				}
+			}
+			bOk = PipelineComplete(pipeline) && bOk;
+			delete pipeline;
+		}
+
+		Progress(bOk ? "OK!\n" : "FAILED!\n");
+	}
+
+	delete[] keptAddr;
+	delete[] kept;
+	return bOk;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Erase, program and verify a streamed image as it arrives. Each step takes
+// the data up to the next 64K boundary, so whole blocks can be block erased,
+// and is erased, programmed and verified before the next is read. Nothing
+// past the end of the stream is erased, as with EraseArea it is rounded up to
+// a whole sector
+////////////////////////////////////////////////////////////////////////////////
+
+#define STREAM_BLOCK_SIZE	65536
+
+bool ConfigSession::ProgramStream(ImageStream* pStream, const u32 writeAddr, const u8 mode)
+{
+	Progress("Streaming to $%x... ", writeAddr);
+
+	u8* block = new u8[STREAM_BLOCK_SIZE];
+	u8* current = new u8[STREAM_BLOCK_SIZE];
+	PagePipeline* pipeline = new PagePipeline;
+	PipelineInit(pipeline);
+
+	bool bOk = true;
+	u32 nBlankPages = 0;
+	u32 nSectors = 0;
+	u32 nUnchanged = 0;
+	u32 addr = writeAddr;
+	while (bOk)
+	{
+		// time spent waiting on the decoder is charged to the image
+		u32 len;
+		{
+			StatScope scope(this, STAT_OP_IMAGE);
+			len = ImageStreamRead(pStream, block, STREAM_BLOCK_SIZE - (addr & (STREAM_BLOCK_SIZE - 1)));
+		}
+		if (!len)
+		{
+			break;
+		}
+		if (addr + len > m_pDevice->nSize)
+		{
+			Progress("too big for %s config flash, ", m_pDevice->pName);
+			bOk = false;
+			break;
+		}
+
+		// sectors of this step that need writing
+		const u32 firstSector = addr & ~4095;
+		const u32 nStepSectors = (((addr + len + 4095) & ~4095) - firstSector) / 4096;
+		u8 dirty[STREAM_BLOCK_SIZE / 4096];
+		memset(dirty, 1, sizeof(dirty));
+		nSectors += nStepSectors;
+
+		// differential only erases and programs sectors that have changed, they
+		// are read whole and programmed from what was read with the step laid
+		// over it, so what the stream doesn't cover goes back in
+		const u8* pSource = block;
+		u32 sourceAddr = addr;
+		u32 sourceLen = len;
+		if (mode & PROG_DIFFERENTIAL)
+		{
+			bOk = PipelineComplete(pipeline) && ReadBytes(firstSector, current, nStepSectors * 4096);
+			for (u32 n = 0; bOk && n < nStepSectors; n++)
+			{
+				u32 start = firstSector + n * 4096;
+				u32 end = start + 4096;
+				if (start < addr) start = addr;
+				if (end > addr + len) end = addr + len;
+				dirty[n] = memcmp(block + (start - addr), current + (start - firstSector), end - start) != 0;
+				if (!dirty[n]) nUnchanged++;
+			}
+			bOk = bOk && EraseSectors(firstSector, dirty, nStepSectors);
+
+			memcpy(current + (addr - firstSector), block, len);
+			pSource = current;
+			sourceAddr = firstSector;
+			sourceLen = nStepSectors * 4096;
+		}
+		else if (mode & PROG_ERASE)
+		{
+			bOk = PipelineComplete(pipeline) && EraseArea(addr, len);
+		}
+
+		// program the pages that need it
+		if (mode & (PROG_PROGRAM | PROG_DIFFERENTIAL))
+		{
+			u32 offset = 0;
+			while (bOk && offset < sourceLen)
+			{
+				u32 page = 256 - ((sourceAddr + offset) & 255);
+				if (page > sourceLen - offset) page = sourceLen - offset;
+
+				if (dirty[(sourceAddr + offset - firstSector) / 4096])
+				{
+					if (PageIsBlank(pSource + offset, page)) nBlankPages++;
+					else bOk = PipelineWritePage(pipeline, sourceAddr + offset, pSource + offset, page);
+				}
+				offset += page;
+			}
+		}
+
+		// and check it went in
+		if (bOk && (mode & PROG_VERIFY))
+		{
+			bOk = PipelineComplete(pipeline) && ReadBytes(addr, current, len) && memcmp(block, current, len) == 0;
+		}
+
+		addr += len;
+		Progress("%6dKB\b\b\b\b\b\b\b\b", (addr - writeAddr) / 1024);
+	}
+
+	bOk = PipelineComplete(pipeline) && bOk;
+	delete pipeline;
+	delete[] current;
+	delete[] block;
+
+	// the input may have been cut short or corrupt
+	bOk = ImageStreamClose(pStream) && bOk;
+	if (!bOk || addr == writeAddr)
+	{
+		Progress("FAILED!\n");
+		return false;
+	}
+
+	Progress("OK! ($%x-$%x", writeAddr, addr - 1);
+	if (mode & PROG_DIFFERENTIAL) Progress(", %d of %d sectors changed", nSectors - nUnchanged, nSectors);
+	if (nBlankPages) Progress(", %d blank pages skipped", nBlankPages);
+	Progress(")\n");
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Erase, program and verify an image in memory as the mode asks
+////////////////////////////////////////////////////////////////////////////////
+
+bool ConfigSession::ProgramImage(const Image* pImage, const u8 mode)
+{
+	if (pImage->nAddress + pImage->nSize > m_pDevice->nSize)
+	{
+		Progress("Image too big for %s config flash.\n", m_pDevice->pName);
+		return false;
+	}
+
+	bool bOk = true;
+	u8 phases = mode;
+
+	// differential programming replaces the erase and program phases
+	if (mode & PROG_DIFFERENTIAL)
+	{
+		phases &= PROG_VERIFY;
+		bOk = ProgramDifferential(pImage);
+	}
+
+	if (bOk && (phases & PROG_ERASE))
+	{
+		bOk = EraseImage(pImage);
+	}
+
+	if (bOk && (phases & PROG_PROGRAM))
+	{
+		bOk = ProgramPages(pImage);
+	}
+
+	if (bOk && (phases & PROG_VERIFY))
+	{
+		bOk = VerifyImage(pImage);
+	}
+
+	return bOk;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Read test, time a read of the area in the current read mode and check it
+// matches a normal read so we know the mode is safe on this board
+////////////////////////////////////////////////////////////////////////////////
+
+void ConfigSession::ReadTest(u32 addr, u32 size)
+{
+	u8* data = new u8[size];
+	u8* reference = new u8[size];
+
+	const u8 mode = m_nReadMode;
+	m_nReadMode = READ_MODE_NORMAL;
+	bool bOk = ReadBytes(addr, reference, size);
+	m_nReadMode = mode;
+
+	printf("Read test ($%x-$%x, %s read)... ", addr, addr + size - 1, gReadModeNames[ReadMode()]);
+
+	const u64 start = Now();
+	bOk = bOk && ReadBytes(addr, data, size);
+	const u64 elapsed = Now() - start;
+
+	if (!bOk) printf("FAILED!\n");
+	else if (memcmp(data, reference, size) != 0) printf("MISMATCH!\n");
+	else printf("OK! (%.2fMB/s)\n", elapsed ? (double)size / elapsed : 0.0);
+
+	delete[] reference;
+	delete[] data;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Transport tuning
+// Each candidate profile is timed on short status reads (the round trips that
+// dominate erasing and programming) and a bulk read, then scored on the time
+// a 1MB program and verify would take. The best is left applied.
+////////////////////////////////////////////////////////////////////////////////
+
+bool ConfigSession::MeasureTransport(u64* pRoundTripUs, u64* pBulkUs, u8* pBuffer)
+{
+	u16 status;
+	bool bOk = GetStatus(&status);
+
+	u64 start = Now();
+	for (u32 n = 0; bOk && n < TUNE_ROUND_TRIPS; n++)
+	{
+		bOk = GetStatus(&status);
+	}
+	*pRoundTripUs = (Now() - start) / TUNE_ROUND_TRIPS;
+
+	start = Now();
+	bOk = bOk && ReadBytes(0, pBuffer, TUNE_BULK_SIZE);
+	*pBulkUs = Now() - start;
+
+	return bOk;
+}
+
+bool ConfigSession::TuneTransport()
+{
+	u8* buffer = new u8[TUNE_BULK_SIZE];
+	const TransportProfile original = m_profile;
+	TransportProfile best = original;
+	u64 bestCost = ~0ull;
+
+	printf("Tuning USB transport...\n");
+	for (u32 l = 0; l < COUNTOF(gTuneLatencies); l++)
+	{
+		for (u32 c = 0; c < COUNTOF(gTuneChunks); c++)
+		{
+			TransportProfile profile = { gTuneLatencies[l], gTuneChunks[c], gTuneChunks[c] };
+			u64 roundTripUs, bulkUs;
+			if (!SetTransport(profile) || !MeasureTransport(&roundTripUs, &bulkUs, buffer))
+			{
+				printf("  latency %3dms  chunk %5d  FAILED!\n", profile.latencyMs, profile.readChunk);
+				continue;
+			}
+
+			const u64 cost = roundTripUs * TUNE_WORKLOAD_ROUND_TRIPS + bulkUs * (TUNE_WORKLOAD_BYTES / TUNE_BULK_SIZE);
+			printf("  latency %3dms  chunk %5d  round trip %5lluus  read %.2fMB/s\n", profile.latencyMs, profile.readChunk,
+				(unsigned long long)roundTripUs, bulkUs ? (double)TUNE_BULK_SIZE / bulkUs : 0.0);
+
+			if (cost < bestCost)
+			{
+				bestCost = cost;
+				best = profile;
+			}
+		}
+	}
+	delete[] buffer;
+
+	if (bestCost == ~0ull)
+	{
+		SetTransport(original);
+		printf("Tuning USB transport... FAILED!\n");
+		return false;
+	}
+
+	printf("Using latency %dms, chunk %d (~%.2fs per 1MB program and verify).\n", best.latencyMs, best.readChunk, bestCost / 1000000.0);
+	return SetTransport(best);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Automatic clock
+// Device id, unique id and the start of the flash are read at a safe clock
+// for reference, then again from the top of the divisor range down until a
+// clock gives the same every time. If anything faster failed we are close to
+// the edge, so back off one more step for margin.
+////////////////////////////////////////////////////////////////////////////////
+
+static std::mutex gClockCacheMutex;			// sessions may share the cache file
+
+static void ClockCachePath(char* pPath, u32 nSize)
+{
+#ifdef _WIN32
+	const char* home = getenv("USERPROFILE");
+#else
+	const char* home = getenv("HOME");
+#endif
+	snprintf(pPath, nSize, "%s/%s", home ? home : ".", AUTOCLOCK_CACHE_FILE);
+}
+
+static void ClockCacheKey(char* pKey, u32 nSize, const char* pSerial, const u8* pUid)
+{
+	u32 len = snprintf(pKey, nSize, "%s ", pSerial[0] ? pSerial : "-");
+	for (u32 n = 0; n < 16 && len + 2 < nSize; n++)
+	{
+		len += snprintf(pKey + len, nSize - len, "%02X", pUid[n]);
+	}
+}
+
+// cache lines are "serial uid frequency(Hz)"
+static u32 ClockCacheLoad(const char* pKey)
+{
+	std::lock_guard<std::mutex> lock(gClockCacheMutex);
+	char path[512];
+	ClockCachePath(path, sizeof(path));
+
+	FILE* f = 0;
+	if (fopen_s(&f, path, "r") != 0 || !f)
+	{
+		return 0;
+	}
+
+	u32 frequency = 0;
+	char line[256];
+	const size_t keyLen = strlen(pKey);
+	while (fgets(line, sizeof(line), f))
+	{
+		if (strncmp(line, pKey, keyLen) == 0 && line[keyLen] == ' ')
+		{
+			frequency = (u32)strtoul(line + keyLen + 1, NULL, 10);
+		}
+	}
+	fclose(f);
+	return frequency;
+}
+
+static void ClockCacheSave(const char* pKey, u32 nFrequency)
+{
+	std::lock_guard<std::mutex> lock(gClockCacheMutex);
+	char path[512];
+	ClockCachePath(path, sizeof(path));
+
+	// keep everything but any old entry for this key
+	char* kept = new char[65536];
+	size_t keptLen = 0;
+	const size_t keyLen = strlen(pKey);
+	FILE* f = 0;
+	if (fopen_s(&f, path, "r") == 0 && f)
+	{
+		char line[256];
+		while (fgets(line, sizeof(line), f))
+		{
+			const size_t len = strlen(line);
+			if ((strncmp(line, pKey, keyLen) != 0 || line[keyLen] != ' ') && keptLen + len < 65536)
+			{
+				memcpy(kept + keptLen, line, len);
+				keptLen += len;
+			}
+		}
+		fclose(f);
+	}
+
+	if (fopen_s(&f, path, "w") == 0 && f)
+	{
+		fwrite(kept, 1, keptLen, f);
+		fprintf(f, "%s %u\n", pKey, nFrequency);
+		fclose(f);
+	}
+	delete[] kept;
+}
+
+bool ConfigSession::ClockCheckRead(ClockCheck* c)
+{
+	return	ReadDeviceId(&c->id) &&
+			ReadUniqueId(c->uid) &&
+			ReadBytes(0, c->region, AUTOCLOCK_REGION_SIZE);
+}
+
+bool ConfigSession::ClockCheckPasses(const ClockCheck* pReference, ClockCheck* pScratch, u32 nPasses)
+{
+	for (u32 n = 0; n < nPasses; n++)
+	{
+		if (!ClockCheckRead(pScratch) || memcmp(pScratch, pReference, sizeof(ClockCheck)) != 0)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+bool ConfigSession::ClockSearch(const ClockCheck* pReference, ClockCheck* pScratch)
+{
+	bool bFailed = false;
+	for (u32 divisor = 0; MPSSEClockFrequency(false, (u16)divisor) >= AUTOCLOCK_SAFE_FREQUENCY * 1000; divisor++)
+	{
+		MPSSEClock clock = { false, (u16)divisor, MPSSEClockFrequency(false, (u16)divisor) };
+		if (SetClock(clock) && ClockCheckPasses(pReference, pScratch, AUTOCLOCK_PASSES))
+		{
+			// margin when something faster failed, then soak what we settle on
+			if (bFailed)
+			{
+				clock.nDivisor++;
+				clock.nFrequency = MPSSEClockFrequency(false, clock.nDivisor);
+			}
+
+			if (SetClock(clock) && ClockCheckPasses(pReference, pScratch, AUTOCLOCK_SOAK_PASSES))
+			{
+				return true;
+			}
+		}
+		bFailed = true;
+	}
+	return false;
+}
+
+bool ConfigSession::AutoFrequency(bool bUseCache)
+{
+	ClockCheck* reference = new ClockCheck;
+	ClockCheck* scratch = new ClockCheck;
+
+	Progress("Finding SPI clock... ");
+
+	// reference reads, which must agree with each other before we trust them
+	bool bOk =	SetFrequency(AUTOCLOCK_SAFE_FREQUENCY) &&
+				ClockCheckRead(reference) &&
+				ClockCheckPasses(reference, scratch, 1) &&
+				reference->id != 0x0000 && reference->id != 0xffff;
+
+	char key[128];
+	ClockCacheKey(key, sizeof(key), m_serial, reference->uid);
+
+	// a cached clock only needs confirming
+	bool bCached = false;
+	if (bOk && bUseCache)
+	{
+		const u32 frequency = ClockCacheLoad(key);
+		bCached =	frequency &&
+					SetClock(MPSSEPlanClock(frequency)) &&
+					ClockCheckPasses(reference, scratch, AUTOCLOCK_PASSES);
+	}
+
+	if (bOk && !bCached)
+	{
+		bOk = ClockSearch(reference, scratch);
+		if (bOk) ClockCacheSave(key, m_clock.nFrequency);
+	}
+
+	if (bOk)
+	{
+		Progress("OK! (%.3fMhz%s)\n", m_clock.nFrequency / 1000000.0, bCached ? ", cached" : "");
+	}
+	else
+	{
+		SetFrequency(AUTOCLOCK_SAFE_FREQUENCY);
+		Progress("FAILED! (using %.3fMhz)\n", m_clock.nFrequency / 1000000.0);
+	}
+
+	delete scratch;
+	delete reference;
+	return bOk;
+}
@@ -0,0 +1,391 @@
+#ifndef _CONFIGSESSION_H_
+#define _CONFIGSESSION_H_
+
+#include "ftdi.h"
+#include "Types.h"
+#include "Image.h"
+#include "MPSSE.h"
+#include "Transport.h"
+#include "Stats.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// FT2232H
+// Config Flash		JTAG
+// Channel A		Channel B
+// AD0, CCK			BD0, TCK
+// AD1, CDI0		BD1, TDI
+// AD2, CDI1		BD2, TDO
+// AD3, SS#			BD3, TMS
+// AD4, CRESET_N
+// AD5, CDONE
+////////////////////////////////////////////////////////////////////////////////
+
+#define CA_CCK							0x01
+#define CA_CDI0							0x02
+#define CA_CDI1							0x04
+#define CA_SS_N							0x08
+#define CA_CRESET_N						0x10
+#define CA_CDONE						0x20
+
+#define CB_TCK							0x01
+#define CB_TDI							0x02
+#define CB_TDO							0x04
+#define CB_TMS							0x08
+
+////////////////////////////////////////////////////////////////////////////////
+// EEPROM commands
+////////////////////////////////////////////////////////////////////////////////
+
+#define CMD_READ_STATUS_REGISTER1		0x05
+#define CMD_READ_STATUS_REGISTER2		0x35
+#define CMD_READ_DEVICE_ID				0x90
+#define CMD_READ_UNIQUE_ID				0x4b
+#define CMD_WRITE_STATUS_REGISTERS		0x01
+#define CMD_WRITE_ENABLE				0x06
+#define CMD_WRITE_DISABLE				0x04
+#define CMD_SECTOR_ERASE				0x20		// 4K sector
+#define CMD_CHIP_ERASE					0x60
+#define CMD_CHIP_ERASE_ALT				0xc7
+#define CMD_BLOCK_ERASE_32K				0x52
+#define CMD_BLOCK_ERASE_64K				0xd8
+#define CMD_PROGRAM_PAGE				0x02		// 256 byte page
+#define CMD_READ_BYTES					0x03
+#define CMD_FAST_READ					0x0b		// needs 8 dummy clocks
+#define CMD_DUAL_OUTPUT_READ			0x3b		// needs 8 dummy clocks
+#define CMD_WAKE_UP						0xab
+#define CMD_POWER_DOWN					0xb9
+#define CMD_READ_JEDEC_ID				0x9f
+#define CMD_RESET_ENABLE				0x66
+#define CMD_RESET						0x99
+
+#define	STATUS_IN_PROGRESS				0x01
+#define	STATUS_WRITE_ENABLE				0x02
+#define	STATUS_BLOCK_PROTECT_SHIFT		2
+#define	STATUS_BLOCK_PROTECT_MASK		0x001f
+#define	STATUS_REGISTER_PROTECT_SHIFT	7
+#define	STATUS_REGISTER_PROTECT_MASK	0x0180
+#define	STATUS_QUAD_ENABLE				0x0200
+
+////////////////////////////////////////////////////////////////////////////////
+// SPI clock frequencies (kHz), the MPSSE can manage 30/(n+1)Mhz exactly, others
+// are rounded down to the next of those (see MPSSEPlanClock)
+////////////////////////////////////////////////////////////////////////////////
+
+#define SPI_6MHZ	6000
+#define SPI_7_5MHZ	7500
+#define SPI_10MHZ	10000
+#define SPI_15MHZ	15000
+#define SPI_30MHZ	30000
+#define SPI_AUTO	0			// search for the fastest reliable clock
+
+////////////////////////////////////////////////////////////////////////////////
+// Automatic clock
+// Each 30/(n+1)Mhz step is checked against reads made at a safe clock, the
+// result is cached per adapter serial and flash unique id.
+////////////////////////////////////////////////////////////////////////////////
+
+#define AUTOCLOCK_SAFE_FREQUENCY		1000		// kHz, reference reads
+#define AUTOCLOCK_REGION_SIZE			4096		// bytes read at each step
+#define AUTOCLOCK_PASSES				3			// consistent reads to pass a step
+#define AUTOCLOCK_SOAK_PASSES			16			// and for the clock settled on
+#define AUTOCLOCK_CACHE_FILE			".trionftdi_clock"
+
+struct ClockCheck
+{
+	u16 id;
+	u8 uid[16];
+	u8 region[AUTOCLOCK_REGION_SIZE];
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Transport
+////////////////////////////////////////////////////////////////////////////////
+
+#define TRANSPORT_BUFFERS				3
+#define TRANSPORT_BUFFER_SIZE			65536
+
+struct TransportBuffer
+{
+	u8 data[TRANSPORT_BUFFER_SIZE];
+	TransportRequest* tc;
+	s32 size;
+	u8 nStatOp;				// operation that submitted it
+};
+
+// what has gone over USB, and how often we have waited on the flash
+struct TransportCounters
+{
+	u64 nWrites;			// transfers submitted
+	u64 nWriteBytes;
+	u64 nReads;
+	u64 nReadBytes;
+	u64 nPolls;				// status bursts read while the flash was busy
+	u64 nDelays;			// sleeps while the flash was busy
+	u64 nDelayMs;
+	u64 nResends;			// pages sent again, the one before outlasting its burst
+};
+
+#define TUNE_ROUND_TRIPS				64			// timed per candidate
+#define TUNE_BULK_SIZE					0x40000		// bytes read per candidate
+#define TUNE_WORKLOAD_ROUND_TRIPS		4096		// a page program each for 1MB
+#define TUNE_WORKLOAD_BYTES				0x100000	// and reading it back
+
+////////////////////////////////////////////////////////////////////////////////
+// Flash devices and timing
+////////////////////////////////////////////////////////////////////////////////
+
+#define FLASH_TIMED_OPS					6
+
+struct FlashOpTiming
+{
+	u8 cmd;
+	u32 typUs;
+	u32 maxUs;
+};
+
+struct FlashDevice
+{
+	u16 id;
+	const char* pName;
+	u32 nSize;				// bytes
+	FlashOpTiming timing[FLASH_TIMED_OPS];
+};
+
+struct FlashOpState
+{
+	u8 cmd;
+	u32 typUs;
+	u32 maxUs;
+	u32 expectedUs;
+	u32 count;
+};
+
+#define POLL_MAX_BURST					8192		// max status bytes per burst
+#define POLL_MIN_SLEEP_MS				2			// below this, don't bother
+
+////////////////////////////////////////////////////////////////////////////////
+// Page programming pipeline
+////////////////////////////////////////////////////////////////////////////////
+
+struct PagePipeline
+{
+	MPSSECommands stream[2];
+	u32 nNext;				// stream to build next
+	bool bInFlight;			// a page is currently programming
+	u32 nPollBytes;			// status bytes read after the page in flight
+	u8 status[POLL_MAX_BURST];
+	TransportRequest* tc;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Reading
+////////////////////////////////////////////////////////////////////////////////
+
+#define READ_MODE_AUTO					0
+#define READ_MODE_NORMAL				1
+#define READ_MODE_FAST					2
+#define READ_MODE_DUAL					3
+#define READ_MODES						4
+
+#define READ_NORMAL_MAX_FREQUENCY		20000		// kHz, conservative
+
+extern const char* gReadModeNames[READ_MODES];
+
+#define READ_MAX_SIZE					0x1000000	// 24 bit address space
+#define READ_CHUNK_SIZE					65536		// max per MPSSE read command
+
+#define READ_STREAM_CHUNK				16384
+
+// libftdi reads all go through the context's one read buffer, so only one
+// can be in flight. The next chunk arrives into one buffer while the caller
+// works on the other.
+struct ReadStream
+{
+	u8 buf[2][READ_STREAM_CHUNK];
+	TransportRequest* tc;	// the read in flight
+	u32 size;				// its size
+	u32 nSlot;				// and the buffer it fills
+	u32 nTotal;				// bytes in the whole read
+	u32 nSubmitted;			// bytes submitted so far
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Programming modes
+////////////////////////////////////////////////////////////////////////////////
+
+#define PROG_ERASE			1
+#define PROG_PROGRAM		2
+#define PROG_VERIFY			4
+#define PROG_DIFFERENTIAL	8
+
+#define VERIFY_CHUNK_SIZE	READ_STREAM_CHUNK
+
+////////////////////////////////////////////////////////////////////////////////
+// Statistics, see Stats.h. A StatScope charges everything done until it goes
+// out of scope to one operation, and costs a pointer test when stats are off.
+////////////////////////////////////////////////////////////////////////////////
+
+class ConfigSession;
+
+class StatScope
+{
+public:
+	StatScope(ConfigSession* pSession, u8 op);
+	~StatScope();
+
+private:
+	u64 Now();
+
+	ConfigSession* m_pSession;
+	SessionStats* m_pStats;
+	u8 m_nOp;
+	u8 m_nPrevious;
+	u64 m_start;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Config session
+// Owns one FT2232H and the config flash attached to it. Nothing is shared
+// between sessions, so several can be driven at once from separate threads.
+////////////////////////////////////////////////////////////////////////////////
+
+class ConfigSession
+{
+public:
+	ConfigSession();
+	~ConfigSession();
+
+	// device
+	static u32 FindAdapters(AdapterInfo* pList, u32 nMax);
+	void SetBackend(u8 nBackend, const char* pOption = 0);
+	void SetCapture(const char* pFilename);
+	bool Init(u32 frequency = SPI_10MHZ, const AdapterInfo* pAdapter = 0);
+	bool SetTransport(const TransportProfile& profile);
+	const TransportProfile& Profile() const { return m_profile; }
+	bool TuneTransport();
+	const TransportCounters& Counters() const { return m_counters; }
+	void ResetCounters();
+	void SetStats(SessionStats* pStats) { m_pStats = pStats; }
+	SessionStats* Stats() const { return m_pStats; }
+	void Term();
+	bool Idle();
+	bool FPGAReset(bool bReset);
+	bool SetFrequency(u32 frequency);
+	bool SetClock(const MPSSEClock& clock);
+	bool AutoFrequency(bool bUseCache = true);
+	const char* Serial() const { return m_serial; }
+	u32 SPIFrequency() const { return m_nSPIFrequency; }
+	const MPSSEClock& Clock() const { return m_clock; }
+	void SetQuiet(bool bQuiet) { m_bQuiet = bQuiet; }
+
+	// transport
+	bool Write(const void* pData, u32 nSize);
+	bool Flush();
+	TransportRequest* ReadSubmit(void* pInData, const u32 nLength);
+	bool ReadWait(TransportRequest* tc, const u32 nLength);
+	u64 Now();
+	void Delay(u32 ms);
+	bool ReadData(void *pInData, const u32 nLength);
+
+	// SPI
+	bool ChipSelect(bool bSelect);
+	MPSSECommands& Commands();
+	bool Execute(MPSSECommands& cmds);
+	bool WriteSPI(const void *pOutData, const int nLength, void *pInData = 0);
+	bool DummySPI(const u32 nLength);
+	bool WriteCommand(u8 cmd);
+	bool WriteCommandWithData(u8 cmd, const void *bufOut, void *bufIn, u32 size);
+	bool WriteCommandWithAddrAndData(u8 cmd, u32 addr, const void *bufOut, void *bufIn, u32 size);
+
+	// flash
+	bool Reset();
+	bool WakeUp();
+	bool ReadDeviceId(u16 *id);
+	bool ReadUniqueId(void *uid);
+	bool Identify();
+	void ShowDeviceInfo();
+	const FlashDevice* Device() const { return m_pDevice; }
+	bool WriteEnable();
+	bool GetStatus(u16 *status);
+	bool SetStatus(const u16 status);
+	bool PollStatusComplete(u8 cmd = CMD_PROGRAM_PAGE, u32 nElapsedUs = 0);
+
+	// timing
+	static const FlashDevice* FindDevice(u16 id);
+	void LoadTiming(const FlashDevice* pDevice);
+	FlashOpState* GetTiming(u8 cmd);
+	u32 ExpectedTime(u8 cmd);
+	void UpdateTiming(u8 cmd, u32 measuredUs);
+
+	// erase
+	bool EraseAll();
+	bool EraseSector(u32 addr);
+	bool EraseBlock32(u32 addr);
+	bool EraseBlock64(u32 addr);
+	bool EraseArea(u32 addr, u32 size);
+	bool EraseSectors(u32 addr, const u8* pMask, u32 nSectors);
+
+	// program
+	bool WritePage(u32 nAddress, const void* pData, u32 nSize = 256);
+	void PipelineInit(PagePipeline* p);
+	bool PipelineComplete(PagePipeline* p);
+	bool PipelineCollect(PagePipeline* p, bool* pDone);
+	bool PipelineWritePage(PagePipeline* p, u32 nAddress, const void* pData, u32 nSize);
+
+	// read
+	void SetReadMode(u8 mode) { m_nReadMode = mode; }
+	u8 ReadMode();
+	bool ReadCanStream();
+	bool ReadStart(u32 nAddress, u32 nSize);
+	bool ReadDual(u32 nAddress, void* pData, u32 nSize);
+	bool ReadBytes(u32 nAddress, void* pData, u32 nSize = 256);
+	bool ReadDiscard(u32 nSize);
+	bool ReadStreamStart(ReadStream* s, u32 nAddress, u32 nSize);
+	const u8* ReadStreamNext(ReadStream* s, u32* pSize);
+	void ReadStreamEnd(ReadStream* s);
+	void ReadTest(u32 addr, u32 size);
+
+	// whole images
+	bool ProgramImage(const Image* pImage, const u8 mode = PROG_PROGRAM | PROG_ERASE | PROG_VERIFY);
+	bool EraseImage(const Image* pImage);
+	bool ProgramPages(const Image* pImage);
+	bool VerifyImage(const Image* pImage);
+	bool ProgramDifferential(const Image* pImage);
+	bool ProgramStream(ImageStream* pStream, const u32 writeAddr, const u8 mode = PROG_PROGRAM | PROG_ERASE | PROG_VERIFY);
+
+private:
+	ConfigSession(const ConfigSession&) = delete;
+	ConfigSession& operator=(const ConfigSession&) = delete;
+
+	void Progress(const char* pFormat, ...);
+	bool TransportWait(TransportBuffer* t);
+	bool ApplyTransport();
+	bool MeasureTransport(u64* pRoundTripUs, u64* pBulkUs, u8* pBuffer);
+	bool Control(u8 nBits);
+	u32 PollBurstSize(u32 us);
+	bool ReadStreamSubmit(ReadStream* s);
+	bool ClockCheckRead(ClockCheck* c);
+	bool ClockCheckPasses(const ClockCheck* pReference, ClockCheck* pScratch, u32 nPasses);
+	bool ClockSearch(const ClockCheck* pReference, ClockCheck* pScratch);
+
+	Transport* m_pTransport;
+	u8 m_nBackend;
+	const char* m_pBackendOption;
+	const char* m_pCaptureFile;					// trace everything to this
+	TransportBuffer* m_transport;				// TRANSPORT_BUFFERS of them
+	u32 m_nTransportNext;
+	TransportProfile m_profile;
+	TransportCounters m_counters;
+	SessionStats* m_pStats;						// only when asked for
+	u8 m_nGPIO;									// CRESET_N / SS_N state
+	u32 m_nSPIFrequency;						// kHz
+	MPSSEClock m_clock;							// as actually set
+	u8 m_nReadMode;
+	const FlashDevice* m_pDevice;
+	FlashOpState m_timing[FLASH_TIMED_OPS];
+	bool m_bQuiet;								// no progress output
+	char m_serial[64];							// adapter serial, if it has one
+	MPSSECommands m_cmds;						// reused for every sequence
+};
+
+#endif // _CONFIGSESSION_H_
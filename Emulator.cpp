@@ -0,0 +1,816 @@
+#include <stdio.h>
+#include <string.h>
+#include "Platform.h"
+#include "ftdi.h"
+#include "MPSSE.h"
+#include "ConfigSession.h"
+#include "Emulator.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Emulated flash
+// Commands are decoded a byte at a time as they are clocked in, anything that
+// changes the array happens when CS goes high, as on the real part. Block
+// protect bits are kept in the status register but not enforced.
+////////////////////////////////////////////////////////////////////////////////
+
+static const u8 gEmulatedUniqueId[16] =
+{
+	'E', 'M', 'U', 'L', 'A', 'T', 'E', 'D', 0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77
+};
+
+EmulatedFlash::EmulatedFlash()
+	: m_pData(new u8[EMU_FLASH_SIZE])
+	, m_bSelected(false)
+	, m_bIgnore(false)
+	, m_cmd(0)
+	, m_nBytes(0)
+	, m_nBits(0)
+	, m_nAddress(0)
+	, m_nPageBytes(0)
+	, m_status1(0)
+	, m_status2(0)
+	, m_bWriteEnable(false)
+	, m_bResetEnable(false)
+	, m_bPowerDown(false)
+	, m_nBusyUntil(0)
+	, m_nDualBit(0)
+{
+	memset(m_pData, 0xff, EMU_FLASH_SIZE);
+}
+
+EmulatedFlash::~EmulatedFlash()
+{
+	delete[] m_pData;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Contents, a missing file is an erased part
+////////////////////////////////////////////////////////////////////////////////
+
+bool EmulatedFlash::Load(const char* pFilename)
+{
+	FILE* f = 0;
+	if (fopen_s(&f, pFilename, "rb") != 0 || !f)
+	{
+		return false;
+	}
+
+	memset(m_pData, 0xff, EMU_FLASH_SIZE);
+	fread(m_pData, 1, EMU_FLASH_SIZE, f);
+	fclose(f);
+	return true;
+}
+
+bool EmulatedFlash::Save(const char* pFilename)
+{
+	FILE* f = 0;
+	if (fopen_s(&f, pFilename, "wb") != 0 || !f)
+	{
+		return false;
+	}
+
+	const bool bOk = fwrite(m_pData, 1, EMU_FLASH_SIZE, f) == EMU_FLASH_SIZE;
+	fclose(f);
+	return bOk;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+u8 EmulatedFlash::Status1(u64 now) const
+{
+	return	(m_status1 & ~(STATUS_IN_PROGRESS | STATUS_WRITE_ENABLE)) |
+			(Busy(now) ? STATUS_IN_PROGRESS : 0) |
+			(m_bWriteEnable ? STATUS_WRITE_ENABLE : 0);
+}
+
+u8 EmulatedFlash::DataByte(u32 nOffset) const
+{
+	return m_pData[nOffset & (EMU_FLASH_SIZE - 1)];
+}
+
+void EmulatedFlash::Select()
+{
+	m_bSelected = true;
+	m_bIgnore = false;
+	m_nBytes = 0;
+	m_nBits = 0;
+	m_nAddress = 0;
+	m_nPageBytes = 0;
+	m_nDualBit = 0;
+	memset(m_page, 0xff, sizeof(m_page));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// One byte in, one out (on IO1)
+////////////////////////////////////////////////////////////////////////////////
+
+u8 EmulatedFlash::Byte(u8 in, u64 now)
+{
+	if (!m_bSelected)
+	{
+		return 0xff;
+	}
+
+	const u32 n = m_nBytes++;
+	if (n == 0)
+	{
+		// powered down only wake up is heard, busy only status reads
+		m_cmd = in;
+		if (m_bPowerDown) m_bIgnore = in != CMD_WAKE_UP;
+		else if (Busy(now)) m_bIgnore = in != CMD_READ_STATUS_REGISTER1 && in != CMD_READ_STATUS_REGISTER2;
+		return 0xff;
+	}
+
+	if (m_bIgnore)
+	{
+		return 0xff;
+	}
+
+	// 24 bit address follows most commands
+	if (n <= 3)
+	{
+		m_nAddress = (m_nAddress << 8) | in;
+	}
+
+	switch (m_cmd)
+	{
+		case CMD_READ_STATUS_REGISTER1:	return Status1(now);
+		case CMD_READ_STATUS_REGISTER2:	return m_status2;
+		case CMD_READ_DEVICE_ID:		return n < 4 ? 0xff : (((n - 4) ^ m_nAddress) & 1) ? EMU_FLASH_DEVICE : EMU_FLASH_MANUFACTURER;
+		case CMD_READ_UNIQUE_ID:		return n < 5 ? 0xff : gEmulatedUniqueId[(n - 5) & 15];
+		case CMD_READ_BYTES:			return n < 4 ? 0xff : DataByte(m_nAddress + n - 4);
+		case CMD_FAST_READ:				return n < 5 ? 0xff : DataByte(m_nAddress + n - 5);
+		case CMD_WAKE_UP:				return n < 4 ? 0xff : EMU_FLASH_DEVICE;
+
+		case CMD_READ_JEDEC_ID:
+			return n == 1 ? EMU_FLASH_MANUFACTURER : n == 2 ? EMU_FLASH_MEMORY_TYPE : n == 3 ? EMU_FLASH_CAPACITY : 0xff;
+
+		case CMD_DUAL_OUTPUT_READ:
+			if (n >= 5) m_nDualBit += 16;
+			return 0xff;
+
+		case CMD_WRITE_STATUS_REGISTERS:
+			if (n <= 2) m_page[n - 1] = in;
+			return 0xff;
+
+		case CMD_PROGRAM_PAGE:
+			if (n >= 4)
+			{
+				// wraps within the page, only the last 256 bytes count
+				m_page[(m_nAddress + n - 4) & 255] = in;
+				m_nPageBytes++;
+			}
+			return 0xff;
+	}
+
+	return 0xff;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Clocks with no data, dual read moves on two bits a clock
+////////////////////////////////////////////////////////////////////////////////
+
+void EmulatedFlash::Clocks(u32 nClocks, u64 now)
+{
+	if (!m_bSelected)
+	{
+		return;
+	}
+
+	if (!m_bIgnore && m_cmd == CMD_DUAL_OUTPUT_READ && m_nBytes >= 5)
+	{
+		m_nDualBit += nClocks * 2;
+		return;
+	}
+
+	m_nBits += nClocks;
+	while (m_nBits >= 8)
+	{
+		m_nBits -= 8;
+		Byte(0, now);
+	}
+}
+
+u8 EmulatedFlash::Pins() const
+{
+	if (m_bSelected && !m_bIgnore && m_cmd == CMD_DUAL_OUTPUT_READ && m_nBytes >= 5)
+	{
+		const u8 data = DataByte(m_nAddress + m_nDualBit / 8);
+		const u32 bit = 7 - (m_nDualBit & 7);
+		return (((data >> bit) & 1) << 1) | ((data >> (bit - 1)) & 1);
+	}
+
+	// released, pulled up
+	return 3;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// CS high, write commands only take effect on a byte boundary
+////////////////////////////////////////////////////////////////////////////////
+
+void EmulatedFlash::Program(u64 now)
+{
+	const u32 base = m_nAddress & ~255 & (EMU_FLASH_SIZE - 1);
+	for (u32 n = 0; n < 256; n++)
+	{
+		m_pData[base + n] &= m_page[n];
+	}
+	m_nBusyUntil = now + (u64)EMU_TIME_PROGRAM_PAGE * 1000000;
+}
+
+void EmulatedFlash::Erase(u32 nSize, u32 us, u64 now)
+{
+	const u32 base = m_nAddress & ~(nSize - 1) & (EMU_FLASH_SIZE - 1);
+	memset(m_pData + base, 0xff, nSize);
+	m_nBusyUntil = now + (u64)us * 1000000;
+}
+
+void EmulatedFlash::Deselect(u64 now)
+{
+	if (!m_bSelected)
+	{
+		return;
+	}
+	m_bSelected = false;
+
+	if (m_bIgnore || m_nBytes == 0 || m_nBits)
+	{
+		return;
+	}
+
+	const bool bResetEnable = m_bResetEnable;
+	m_bResetEnable = false;
+
+	const bool bWrite = m_bWriteEnable;
+	switch (m_cmd)
+	{
+		case CMD_WRITE_ENABLE:				m_bWriteEnable = m_nBytes == 1; return;
+		case CMD_WRITE_DISABLE:				m_bWriteEnable = false; return;
+		case CMD_POWER_DOWN:				m_bPowerDown = true; return;
+		case CMD_WAKE_UP:					m_bPowerDown = false; return;
+		case CMD_RESET_ENABLE:				m_bResetEnable = true; return;
+
+		case CMD_RESET:
+			if (bResetEnable)
+			{
+				m_bWriteEnable = false;
+				m_nBusyUntil = now + 30000000ull;		// tRST 30us
+			}
+			return;
+
+		case CMD_WRITE_STATUS_REGISTERS:
+			if (!bWrite || m_nBytes < 2) return;
+			m_status1 = m_page[0] & ~(STATUS_IN_PROGRESS | STATUS_WRITE_ENABLE);
+			if (m_nBytes >= 3) m_status2 = m_page[1];
+			m_nBusyUntil = now + (u64)EMU_TIME_WRITE_STATUS * 1000000;
+			break;
+
+		case CMD_PROGRAM_PAGE:
+			if (!bWrite || m_nPageBytes == 0) return;
+			Program(now);
+			break;
+
+		case CMD_SECTOR_ERASE:
+			if (!bWrite || m_nBytes != 4) return;
+			Erase(4096, EMU_TIME_SECTOR_ERASE, now);
+			break;
+
+		case CMD_BLOCK_ERASE_32K:
+			if (!bWrite || m_nBytes != 4) return;
+			Erase(32768, EMU_TIME_BLOCK_ERASE_32K, now);
+			break;
+
+		case CMD_BLOCK_ERASE_64K:
+			if (!bWrite || m_nBytes != 4) return;
+			Erase(65536, EMU_TIME_BLOCK_ERASE_64K, now);
+			break;
+
+		case CMD_CHIP_ERASE:
+		case CMD_CHIP_ERASE_ALT:
+			if (!bWrite || m_nBytes != 1) return;
+			m_nAddress = 0;
+			Erase(EMU_FLASH_SIZE, EMU_TIME_CHIP_ERASE, now);
+			break;
+
+		default:
+			return;
+	}
+
+	// anything that wrote clears the write enable latch
+	m_bWriteEnable = false;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Emulated FT2232H
+////////////////////////////////////////////////////////////////////////////////
+
+struct EmuRequest
+{
+	u8* pData;
+	u32 nSize;
+	bool bRead;
+	u64 done;								// writes, when it reached the device
+};
+
+EmulatorTransport::EmulatorTransport(const char* pFilename)
+	: m_pFilename(0)
+	, m_bOpen(false)
+	, m_nLatencyMs(16)
+	, m_now(0)
+	, m_usbOut(0)
+	, m_usbIn(0)
+	, m_pInput(0)
+	, m_nInputSize(0)
+	, m_nInputCapacity(0)
+	, m_nInputPos(0)
+	, m_pArrivals(0)
+	, m_nArrivals(0)
+	, m_nArrivalCapacity(0)
+	, m_pRx(0)
+	, m_pRxReady(0)
+	, m_nRxHead(0)
+	, m_nRxSize(0)
+	, m_nRxCapacity(0)
+	, m_nUnflushed(0)
+	, m_bReading(false)
+	, m_device(0)
+	, m_nPins(0)
+	, m_nDirection(0)
+	, m_bDiv5(true)
+	, m_nDivisor(0)
+	, m_nClockPs(0)
+	, m_bStalled(false)
+{
+	if (pFilename)
+	{
+		const size_t len = strlen(pFilename);
+		m_pFilename = new char[len + 1];
+		memcpy(m_pFilename, pFilename, len + 1);
+	}
+	SetClock();
+}
+
+EmulatorTransport::~EmulatorTransport()
+{
+	Close();
+	delete[] m_pRxReady;
+	delete[] m_pRx;
+	delete[] m_pArrivals;
+	delete[] m_pInput;
+	delete[] m_pFilename;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool EmulatorTransport::Open(const AdapterInfo*)
+{
+	if (m_pFilename)
+	{
+		m_flash.Load(m_pFilename);
+	}
+
+	m_bOpen = true;
+	return true;
+}
+
+void EmulatorTransport::Close()
+{
+	if (!m_bOpen)
+	{
+		return;
+	}
+
+	// finish anything still queued so it reaches the flash
+	m_nRxSize = 0;
+	m_nUnflushed = 0;
+	m_bReading = false;
+	while (m_nInputPos < m_nInputSize && !m_bStalled)
+	{
+		const u32 used = m_nInputPos;
+		Run();
+		m_nRxSize = 0;
+		if (m_nInputPos == used) break;
+	}
+
+	if (m_pFilename && !m_flash.Save(m_pFilename))
+	{
+		fprintf(stderr, "Unable to save emulated flash to %s.\n", m_pFilename);
+	}
+	m_bOpen = false;
+}
+
+bool EmulatorTransport::Configure(const TransportProfile& profile)
+{
+	m_nLatencyMs = profile.latencyMs;
+	return m_bOpen;
+}
+
+bool EmulatorTransport::GetSerial(char* pSerial, u32 nSize)
+{
+	snprintf(pSerial, nSize, "EMULATOR");
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Transfers
+// Writes are queued for the interpreter, stamped with when they would reach
+// the device. The OUT and IN pipes each carry one transfer at a time.
+////////////////////////////////////////////////////////////////////////////////
+
+TransportRequest* EmulatorTransport::WriteSubmit(const void* pData, u32 nSize)
+{
+	if (!m_bOpen)
+	{
+		return 0;
+	}
+
+	// drop what has been interpreted, then make room
+	if (m_nInputPos)
+	{
+		memmove(m_pInput, m_pInput + m_nInputPos, m_nInputSize - m_nInputPos);
+		for (u32 n = 0; n < m_nArrivals; n++)
+		{
+			m_pArrivals[n].nEnd -= m_nInputPos;
+		}
+		m_nInputSize -= m_nInputPos;
+		m_nInputPos = 0;
+	}
+
+	if (m_nInputSize + nSize > m_nInputCapacity)
+	{
+		u32 capacity = m_nInputCapacity ? m_nInputCapacity : 65536;
+		while (m_nInputSize + nSize > capacity) capacity *= 2;
+		u8* input = new u8[capacity];
+		memcpy(input, m_pInput, m_nInputSize);
+		delete[] m_pInput;
+		m_pInput = input;
+		m_nInputCapacity = capacity;
+	}
+
+	if (m_nArrivals == m_nArrivalCapacity)
+	{
+		const u32 capacity = m_nArrivalCapacity ? m_nArrivalCapacity * 2 : 16;
+		EmuArrival* arrivals = new EmuArrival[capacity];
+		memcpy(arrivals, m_pArrivals, m_nArrivals * sizeof(EmuArrival));
+		delete[] m_pArrivals;
+		m_pArrivals = arrivals;
+		m_nArrivalCapacity = capacity;
+	}
+
+	if (m_usbOut < m_now) m_usbOut = m_now;
+	m_usbOut += (u64)nSize * EMU_USB_PS_PER_BYTE;
+
+	memcpy(m_pInput + m_nInputSize, pData, nSize);
+	m_nInputSize += nSize;
+	m_pArrivals[m_nArrivals].nEnd = m_nInputSize;
+	m_pArrivals[m_nArrivals].time = m_usbOut + (u64)EMU_USB_LATENCY_NS * 1000;
+	m_nArrivals++;
+
+	EmuRequest* r = new EmuRequest;
+	r->pData = 0;
+	r->nSize = nSize;
+	r->bRead = false;
+	r->done = m_pArrivals[m_nArrivals - 1].time;
+
+	Run();
+	return (TransportRequest*)r;
+}
+
+TransportRequest* EmulatorTransport::ReadSubmit(void* pData, u32 nSize)
+{
+	if (!m_bOpen)
+	{
+		return 0;
+	}
+
+	// libftdi fills every read through the context's one buffer, a second
+	// read before the first is waited on would get its data mixed in
+	if (m_bReading)
+	{
+		fprintf(stderr, "Emulator: read submitted with another still outstanding.\n");
+		return 0;
+	}
+	m_bReading = true;
+
+	EmuRequest* r = new EmuRequest;
+	r->pData = (u8*)pData;
+	r->nSize = nSize;
+	r->bRead = true;
+	r->done = 0;
+	return (TransportRequest*)r;
+}
+
+s32 EmulatorTransport::Wait(TransportRequest* pRequest)
+{
+	EmuRequest* r = (EmuRequest*)pRequest;
+	if (!r)
+	{
+		return -1;
+	}
+
+	s32 result = r->nSize;
+	if (!r->bRead)
+	{
+		if (m_now < r->done) m_now = r->done;
+	}
+	else
+	{
+		// interpret as far as needed for the data to exist
+		while (m_nRxSize < r->nSize && m_nInputPos < m_nInputSize && !m_bStalled)
+		{
+			const u32 used = m_nInputPos;
+			Run();
+			if (m_nInputPos == used) break;
+		}
+
+		// it can go once the last byte we want is sent, then libftdi waits
+		// out its timeout for anything that never comes
+		const u32 count = m_nRxSize < r->nSize ? m_nRxSize : r->nSize;
+		u64 ready = m_now;
+		if (count)
+		{
+			const u64 last = m_pRxReady[(m_nRxHead + count - 1) % m_nRxCapacity];
+			if (ready < last) ready = last;
+		}
+		if (count < r->nSize)
+		{
+			ready = m_now + (u64)EMU_USB_TIMEOUT_MS * 1000000000;
+		}
+
+		if (m_usbIn < ready) m_usbIn = ready;
+		m_usbIn += (u64)count * EMU_USB_PS_PER_BYTE;
+		const u64 done = m_usbIn + (u64)EMU_USB_LATENCY_NS * 1000;
+		if (m_now < done) m_now = done;
+
+		for (u32 n = 0; n < count; n++)
+		{
+			r->pData[n] = m_pRx[m_nRxHead];
+			m_nRxHead = (m_nRxHead + 1) % m_nRxCapacity;
+		}
+		m_nRxSize -= count;
+		if (m_nUnflushed > m_nRxSize) m_nUnflushed = m_nRxSize;
+		result = count;
+		m_bReading = false;
+	}
+
+	delete r;
+	return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Interpreter
+// Runs through the queued commands until it runs out or has a good amount of
+// read data waiting to be collected. A command can't start before the write
+// it came in has arrived. Split commands wait for the rest.
+////////////////////////////////////////////////////////////////////////////////
+
+void EmulatorTransport::Run()
+{
+	while (m_nInputPos < m_nInputSize && !m_bStalled && m_nRxSize < EMU_RX_LIMIT)
+	{
+		while (m_nArrivals > 1 && m_pArrivals[0].nEnd <= m_nInputPos)
+		{
+			memmove(m_pArrivals, m_pArrivals + 1, (m_nArrivals - 1) * sizeof(EmuArrival));
+			m_nArrivals--;
+		}
+		if (m_nArrivals && m_device < m_pArrivals[0].time)
+		{
+			m_device = m_pArrivals[0].time;
+		}
+
+		const u32 used = Command(m_pInput + m_nInputPos, m_nInputSize - m_nInputPos);
+		if (!used)
+		{
+			break;
+		}
+		m_nInputPos += used;
+	}
+}
+
+static u8 Reverse(u8 v)
+{
+	v = (u8)(((v & 0xf0) >> 4) | ((v & 0x0f) << 4));
+	v = (u8)(((v & 0xcc) >> 2) | ((v & 0x33) << 2));
+	return (u8)(((v & 0xaa) >> 1) | ((v & 0x55) << 1));
+}
+
+// returns the bytes used, 0 if the command isn't all there yet
+u32 EmulatorTransport::Command(const u8* pCmd, u32 nLeft)
+{
+	const u8 op = pCmd[0];
+	switch (op)
+	{
+		case SET_BITS_LOW:
+			if (nLeft < 3) return 0;
+			SetPins(pCmd[1], pCmd[2]);
+			return 3;
+
+		case SET_BITS_HIGH:
+			return nLeft < 3 ? 0 : 3;
+
+		case GET_BITS_LOW:
+			Receive(GetPins());
+			return 1;
+
+		case GET_BITS_HIGH:
+			Receive(0xff);
+			return 1;
+
+		case TCK_DIVISOR:
+			if (nLeft < 3) return 0;
+			m_nDivisor = (u16)(pCmd[1] | (pCmd[2] << 8));
+			SetClock();
+			return 3;
+
+		case DIS_DIV_5:
+		case EN_DIV_5:
+			m_bDiv5 = op == EN_DIV_5;
+			SetClock();
+			return 1;
+
+		case SEND_IMMEDIATE:
+			Flush();
+			return 1;
+
+		case CLK_BITS:
+			if (nLeft < 2) return 0;
+			Clock(pCmd[1] + 1);
+			return 2;
+
+		case CLK_BYTES:
+			if (nLeft < 3) return 0;
+			Clock(((pCmd[1] | (pCmd[2] << 8)) + 1) * 8);
+			return 3;
+
+		// GPIOL1 is CDONE, which stays high as if the FPGA had configured
+		case WAIT_ON_HIGH:
+		case CLK_WAIT_HIGH:
+			return 1;
+
+		case WAIT_ON_LOW:
+		case CLK_WAIT_LOW:
+			m_bStalled = true;
+			return 1;
+
+		case CLK_BYTES_OR_HIGH:
+			return nLeft < 3 ? 0 : 3;
+
+		case CLK_BYTES_OR_LOW:
+			if (nLeft < 3) return 0;
+			Clock(((pCmd[1] | (pCmd[2] << 8)) + 1) * 8);
+			return 3;
+
+		case LOOPBACK_START:
+		case LOOPBACK_END:
+		case EN_3_PHASE:
+		case DIS_3_PHASE:
+		case EN_ADAPTIVE:
+		case DIS_ADAPTIVE:
+			return 1;
+	}
+
+	// data shifting
+	const bool bWrite = (op & MPSSE_DO_WRITE) != 0;
+	const bool bRead = (op & MPSSE_DO_READ) != 0;
+	if (op < 0x80 && (op & MPSSE_WRITE_TMS))
+	{
+		if (nLeft < 3) return 0;
+		Clock((pCmd[1] & 7) + 1);
+		if (bRead) Receive(0xff);
+		return 3;
+	}
+	else if (op < 0x80 && (op & MPSSE_BITMODE) && (bWrite || bRead))
+	{
+		// only whole bytes reach the flash, bits are just clocked
+		const u32 len = bWrite ? 3 : 2;
+		if (nLeft < len) return 0;
+		Clock((pCmd[1] & 7) + 1);
+		if (bRead) Receive(0xff);
+		return len;
+	}
+	else if (op < 0x80 && (bWrite || bRead))
+	{
+		if (nLeft < 3) return 0;
+		const u32 count = (pCmd[1] | (pCmd[2] << 8)) + 1;
+		const u32 len = 3 + (bWrite ? count : 0);
+		if (nLeft < len) return 0;
+
+		const bool bLSB = (op & MPSSE_LSB) != 0;
+		for (u32 n = 0; n < count; n++)
+		{
+			u8 in = bWrite ? pCmd[3 + n] : 0;
+			if (bLSB) in = Reverse(in);
+			u8 out = SPIByte(in);
+			if (bRead) Receive(bLSB ? Reverse(out) : out);
+		}
+		return len;
+	}
+
+	// anything else is bounced back as a bad command
+	Receive(0xfa);
+	Receive(op);
+	return 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Pins, wired as on the board
+////////////////////////////////////////////////////////////////////////////////
+
+bool EmulatorTransport::Selected() const
+{
+	// an undriven SS# is pulled up
+	return (m_nDirection & CA_SS_N) && !(m_nPins & CA_SS_N);
+}
+
+void EmulatorTransport::SetPins(u8 nPins, u8 nDirection)
+{
+	const bool bWas = Selected();
+	m_nPins = nPins;
+	m_nDirection = nDirection;
+	const bool bNow = Selected();
+
+	if (!bWas && bNow) m_flash.Select();
+	else if (bWas && !bNow) m_flash.Deselect(m_device);
+}
+
+u8 EmulatorTransport::GetPins() const
+{
+	// inputs float high apart from what the flash drives, and CDONE is high
+	u8 inputs = 0xff;
+	if (Selected())
+	{
+		const u8 io = m_flash.Pins();
+		inputs &= ~(CA_CDI0 | CA_CDI1);
+		inputs |= ((io & 1) ? CA_CDI0 : 0) | ((io & 2) ? CA_CDI1 : 0);
+	}
+	return (m_nPins & m_nDirection) | (inputs & ~m_nDirection);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Clocking
+////////////////////////////////////////////////////////////////////////////////
+
+u32 EmulatorTransport::SetClock()
+{
+	m_nClockPs = (u32)(1000000000000ull / MPSSEClockFrequency(m_bDiv5, m_nDivisor));
+	return m_nClockPs;
+}
+
+void EmulatorTransport::Clock(u32 nClocks)
+{
+	m_device += (u64)nClocks * m_nClockPs;
+	if (Selected()) m_flash.Clocks(nClocks, m_device);
+}
+
+u8 EmulatorTransport::SPIByte(u8 in)
+{
+	m_device += (u64)8 * m_nClockPs;
+	return Selected() ? m_flash.Byte(in, m_device) : 0xff;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Read data, held back by the latency timer unless a packet fills or
+// SEND_IMMEDIATE pushes it out
+////////////////////////////////////////////////////////////////////////////////
+
+void EmulatorTransport::Receive(u8 value)
+{
+	if (m_nRxSize == m_nRxCapacity)
+	{
+		const u32 capacity = m_nRxCapacity ? m_nRxCapacity * 2 : 65536;
+		u8* rx = new u8[capacity];
+		u64* ready = new u64[capacity];
+		for (u32 n = 0; n < m_nRxSize; n++)
+		{
+			const u32 index = (m_nRxHead + n) % m_nRxCapacity;
+			rx[n] = m_pRx[index];
+			ready[n] = m_pRxReady[index];
+		}
+		delete[] m_pRxReady;
+		delete[] m_pRx;
+		m_pRx = rx;
+		m_pRxReady = ready;
+		m_nRxHead = 0;
+		m_nRxCapacity = capacity;
+	}
+
+	const u32 index = (m_nRxHead + m_nRxSize) % m_nRxCapacity;
+	m_pRx[index] = value;
+	m_pRxReady[index] = m_device + (u64)m_nLatencyMs * 1000000000;
+	m_nRxSize++;
+
+	if (++m_nUnflushed >= EMU_USB_PACKET_DATA)
+	{
+		Flush();
+	}
+}
+
+void EmulatorTransport::Flush()
+{
+	for (u32 n = m_nRxSize - m_nUnflushed; n < m_nRxSize; n++)
+	{
+		const u32 index = (m_nRxHead + n) % m_nRxCapacity;
+		if (m_pRxReady[index] > m_device) m_pRxReady[index] = m_device;
+	}
+	m_nUnflushed = 0;
+}
@@ -0,0 +1,163 @@
+#ifndef _EMULATOR_H_
+#define _EMULATOR_H_
+
+#include "Types.h"
+#include "Transport.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Emulated FT2232H and config flash
+// Interprets the MPSSE command stream and drives a GD25Q80E class SPI flash
+// wired up as on the board, all on a virtual clock. USB transfers cost a
+// microframe of latency plus bulk transfer time, SPI bytes 8 clocks at the
+// programmed TCK, short reads wait for SEND_IMMEDIATE or the latency timer,
+// and the flash is busy for its typical program and erase times. Nothing
+// depends on the host, so runs are repeatable to the microsecond.
+////////////////////////////////////////////////////////////////////////////////
+
+#define EMU_USB_LATENCY_NS				125000		// one microframe
+#define EMU_USB_PS_PER_BYTE				25000		// ~40MB/s bulk
+#define EMU_USB_PACKET_DATA				510			// 512 less modem status
+#define EMU_USB_TIMEOUT_MS				5000		// reads that never complete
+#define EMU_RX_LIMIT					0x100000	// read data held before we stop interpreting
+
+#define EMU_FLASH_SIZE					0x100000	// 1MB
+#define EMU_FLASH_MANUFACTURER			0xc8
+#define EMU_FLASH_DEVICE				0x13
+#define EMU_FLASH_MEMORY_TYPE			0x40
+#define EMU_FLASH_CAPACITY				0x14
+
+// typical times from the datasheet, us
+#define EMU_TIME_PROGRAM_PAGE			600
+#define EMU_TIME_WRITE_STATUS			2000
+#define EMU_TIME_SECTOR_ERASE			50000
+#define EMU_TIME_BLOCK_ERASE_32K		150000
+#define EMU_TIME_BLOCK_ERASE_64K		250000
+#define EMU_TIME_CHIP_ERASE				3000000
+
+////////////////////////////////////////////////////////////////////////////////
+// SPI NOR flash, times are in picoseconds
+////////////////////////////////////////////////////////////////////////////////
+
+class EmulatedFlash
+{
+public:
+	EmulatedFlash();
+	~EmulatedFlash();
+
+	bool Load(const char* pFilename);
+	bool Save(const char* pFilename);
+
+	void Select();
+	void Deselect(u64 now);
+	u8 Byte(u8 in, u64 now);
+	void Clocks(u32 nClocks, u64 now);
+	u8 Pins() const;						// IO0 in bit 0, IO1 in bit 1
+
+private:
+	EmulatedFlash(const EmulatedFlash&) = delete;
+	EmulatedFlash& operator=(const EmulatedFlash&) = delete;
+
+	bool Busy(u64 now) const { return now < m_nBusyUntil; }
+	u8 Status1(u64 now) const;
+	u8 DataByte(u32 nOffset) const;
+	void Program(u64 now);
+	void Erase(u32 nSize, u32 us, u64 now);
+
+	u8* m_pData;
+	bool m_bSelected;
+	bool m_bIgnore;							// command rejected, wait for deselect
+	u8 m_cmd;
+	u32 m_nBytes;							// clocked in since select, including cmd
+	u32 m_nBits;							// odd clocks towards the next byte
+	u32 m_nAddress;
+	u8 m_page[256];
+	u32 m_nPageBytes;
+	u8 m_status1;							// protection bits, WIP/WEL are live
+	u8 m_status2;
+	bool m_bWriteEnable;
+	bool m_bResetEnable;
+	bool m_bPowerDown;
+	u64 m_nBusyUntil;
+	u32 m_nDualBit;							// bits output so far in dual read
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// FT2232H interface A
+////////////////////////////////////////////////////////////////////////////////
+
+struct EmuArrival
+{
+	u32 nEnd;								// input offset the submit ended at
+	u64 time;								// when it arrived at the device
+};
+
+class EmulatorTransport : public Transport
+{
+public:
+	EmulatorTransport(const char* pFilename = 0);
+	~EmulatorTransport();
+
+	bool Open(const AdapterInfo* pAdapter);
+	void Close();
+	bool Configure(const TransportProfile& profile);
+	bool GetSerial(char* pSerial, u32 nSize);
+	TransportRequest* WriteSubmit(const void* pData, u32 nSize);
+	TransportRequest* ReadSubmit(void* pData, u32 nSize);
+	s32 Wait(TransportRequest* pRequest);
+	u64 Now() { return m_now / 1000000; }
+	void Delay(u32 ms) { m_now += (u64)ms * 1000000000; }
+
+private:
+	EmulatorTransport(const EmulatorTransport&) = delete;
+	EmulatorTransport& operator=(const EmulatorTransport&) = delete;
+
+	void Run();
+	u32 Command(const u8* pCmd, u32 nLeft);
+	void SetPins(u8 nPins, u8 nDirection);
+	u8 GetPins() const;
+	bool Selected() const;
+	void Clock(u32 nClocks);
+	u8 SPIByte(u8 in);
+	void Receive(u8 value);
+	void Flush();
+	u32 SetClock();
+
+	EmulatedFlash m_flash;
+	char* m_pFilename;						// flash contents, loaded and saved
+	bool m_bOpen;
+	u8 m_nLatencyMs;
+
+	// host side, all times are picoseconds
+	u64 m_now;
+	u64 m_usbOut;							// when the OUT pipe is next free
+	u64 m_usbIn;
+
+	// command stream waiting to be interpreted
+	u8* m_pInput;
+	u32 m_nInputSize;
+	u32 m_nInputCapacity;
+	u32 m_nInputPos;
+	EmuArrival* m_pArrivals;
+	u32 m_nArrivals;
+	u32 m_nArrivalCapacity;
+
+	// read data on its way back, with the time each byte can be had
+	u8* m_pRx;
+	u64* m_pRxReady;
+	u32 m_nRxHead;
+	u32 m_nRxSize;
+	u32 m_nRxCapacity;
+	u32 m_nUnflushed;
+	bool m_bReading;						// a read is outstanding, libftdi allows one
+
+	// MPSSE state
+	u64 m_device;							// interpreter clock
+	u8 m_nPins;
+	u8 m_nDirection;
+	bool m_bDiv5;
+	u16 m_nDivisor;
+	u32 m_nClockPs;							// one TCK period
+	bool m_bStalled;						// waiting on a pin that won't change
+};
+
+#endif // _EMULATOR_H_
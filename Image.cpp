@@ -0,0 +1,1466 @@
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define HAVE_SSE2
+#endif
+#if defined(_M_X64) || defined(__x86_64__)
+#include <immintrin.h>
+#define HAVE_AVX2
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TARGET_AVX2
+#else
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+#if defined(__linux__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define HAVE_MMAP
+#endif
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h>
+#else
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+#include "Platform.h"
+#include "Image.h"
+
+#define HEX_SPACE		0x10		// whitespace in the decode table
+#define HEX_INVALID		0xff		// anything else that isn't hex
+#define HEX_BENCH_RUNS	5			// best of this many runs is reported
+
+////////////////////////////////////////////////////////////////////////////////
+// Parse hex file to get size and validity
+////////////////////////////////////////////////////////////////////////////////
+
+s32 HexGetSize(const char* pFilename)
+{
+	s32 nFileSize = -1;
+	FILE* f;
+	if (fopen_s(&f, pFilename, "rt") == 0)
+	{
+		nFileSize = 0;
+		// scan and see how big it is in actual binary terms
+		while (1)
+		{
+			char c = fgetc(f);
+			if (feof(f))
+			{
+				break;
+			}
+
+			// lowercase
+			c = tolower(c);
+
+			// see if character is valid hex
+			if ((c >= 'a' && c <= 'f') ||
+				(c >= '0' && c <= '9'))
+			{
+				nFileSize++;
+			}
+
+			// on an invalid character (non-hex and non-whitespace) return error
+			else if (c != 9 && c != ' ' && c != 10 && c != 13 && c != 0)
+			{
+				nFileSize = -1;
+				break;
+			}
+		}
+
+		fclose(f);
+	}
+
+	return nFileSize >> 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Get number of bytes of binary from hex file
+////////////////////////////////////////////////////////////////////////////////
+
+u32 HexGetBytes(void* buf, FILE* f, u32 size)
+{
+	u8 data = 0;
+	u32 nibbles = 0;
+	u8* out = (u8*)buf;
+	
+	while (size)
+	{
+		char c = fgetc(f);
+		if (feof(f))
+		{
+			break;
+		}
+
+		// lowercase
+		c = tolower(c);
+
+		// get nibble from character
+		bool added = true;
+		if (c >= 'a' && c <= 'f')
+		{
+			data <<= 4;
+			data |= c - ('a' - 10);
+		}
+		else if (c >= '0' && c <= '9')
+		{
+			data <<= 4;
+			data |= c - '0';
+		}
+		else
+		{
+			added = false;
+		}
+
+		// if a whole byte has been read, write it out
+		if (added && (nibbles++ & 1))
+		{
+			*out++ = data;
+			size--;
+		}
+	}
+
+	return nibbles >> 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Decode tables, the value of each character and how to gather the set bytes
+// of an 8 byte group
+////////////////////////////////////////////////////////////////////////////////
+
+struct HexTables
+{
+	u8 value[256];
+	u8 gather[256][8];
+	u8 count[256];
+
+	HexTables()
+	{
+		for (u32 c = 0; c < 256; c++)
+		{
+			if (c >= '0' && c <= '9') value[c] = (u8)(c - '0');
+			else if (tolower(c) >= 'a' && tolower(c) <= 'f') value[c] = (u8)(tolower(c) - ('a' - 10));
+			else if (c == 9 || c == ' ' || c == 10 || c == 13 || c == 0) value[c] = HEX_SPACE;
+			else value[c] = HEX_INVALID;
+		}
+
+		for (u32 m = 0; m < 256; m++)
+		{
+			count[m] = 0;
+			memset(gather[m], 0x80, 8);
+			for (u32 b = 0; b < 8; b++)
+			{
+				if (m & (1 << b)) gather[m][count[m]++] = (u8)b;
+			}
+		}
+	}
+};
+
+static const HexTables gHex;
+
+const char* gHexDecoderNames[HEX_DECODERS] = { "scalar", "sse2", "avx2" };
+
+////////////////////////////////////////////////////////////////////////////////
+// Scalar decoder, the fallback and used for the tail of the vector ones.
+// Gathers the nibble values at pOut and returns the count, or -1 on an invalid
+// character
+////////////////////////////////////////////////////////////////////////////////
+
+static s32 HexGatherScalar(u8* pOut, const u8* pIn, u32 nLength)
+{
+	u8* out = pOut;
+	for (u32 n = 0; n < nLength; n++)
+	{
+		const u8 v = gHex.value[pIn[n]];
+		if (v < 16) *out++ = v;
+		else if (v == HEX_INVALID) return -1;
+	}
+	return (s32)(out - pOut);
+}
+
+static void HexPackScalar(u8* pOut, const u8* pNibbles, u32 nBytes)
+{
+	for (u32 n = 0; n < nBytes; n++)
+	{
+		pOut[n] = (pNibbles[n * 2] << 4) | pNibbles[n * 2 + 1];
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// SSE2 decoder, classifies 16 characters at a time
+////////////////////////////////////////////////////////////////////////////////
+
+#ifdef HAVE_SSE2
+
+// signed compares, so bias both sides to get lo <= c <= hi unsigned
+static inline __m128i InRange128(__m128i c, u8 lo, u8 hi)
+{
+	const __m128i bias = _mm_set1_epi8((char)0x80);
+	const __m128i x = _mm_xor_si128(c, bias);
+	return _mm_and_si128(	_mm_cmpgt_epi8(x, _mm_set1_epi8((char)((lo - 1) ^ 0x80))),
+							_mm_cmplt_epi8(x, _mm_set1_epi8((char)((hi + 1) ^ 0x80))));
+}
+
+static s32 HexGatherSSE2(u8* pOut, const u8* pIn, u32 nLength)
+{
+	u8* out = pOut;
+	u32 n = 0;
+	for (; n + 16 <= nLength; n += 16)
+	{
+		const __m128i c = _mm_loadu_si128((const __m128i*)(pIn + n));
+		const __m128i lower = _mm_or_si128(c, _mm_set1_epi8(0x20));
+		const __m128i digit = InRange128(c, '0', '9');
+		const __m128i alpha = InRange128(lower, 'a', 'f');
+		const __m128i space = _mm_or_si128(	_mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(c, _mm_setzero_si128())),
+											_mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8(9)),
+														 _mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8(10)), _mm_cmpeq_epi8(c, _mm_set1_epi8(13)))));
+		const __m128i hex = _mm_or_si128(digit, alpha);
+		if (_mm_movemask_epi8(_mm_or_si128(hex, space)) != 0xffff)
+		{
+			return -1;
+		}
+
+		const __m128i value = _mm_or_si128(	_mm_and_si128(digit, _mm_sub_epi8(c, _mm_set1_epi8('0'))),
+											_mm_andnot_si128(digit, _mm_sub_epi8(lower, _mm_set1_epi8('a' - 10))));
+		const u32 mask = _mm_movemask_epi8(hex);
+		if (mask == 0xffff)
+		{
+			// all hex, nothing to gather
+			_mm_storeu_si128((__m128i*)out, value);
+			out += 16;
+		}
+		else
+		{
+			// gather each 8 byte group by table, all 8 are written and the ones
+			// past the count overwritten by the next group, out never passes
+			// the group being read
+			u8 temp[16];
+			_mm_storeu_si128((__m128i*)temp, value);
+			for (u32 g = 0; g < 16; g += 8)
+			{
+				const u8 m = (u8)(mask >> g);
+				const u8* gather = gHex.gather[m];
+				for (u32 b = 0; b < 8; b++)
+				{
+					out[b] = temp[g + (gather[b] & 7)];
+				}
+				out += gHex.count[m];
+			}
+		}
+	}
+
+	s32 tail = HexGatherScalar(out, pIn + n, nLength - n);
+	return tail < 0 ? -1 : (s32)(out - pOut) + tail;
+}
+
+static void HexPackSSE2(u8* pOut, const u8* pNibbles, u32 nBytes)
+{
+	const __m128i low = _mm_set1_epi16(0x00ff);
+	u32 n = 0;
+	for (; n + 16 <= nBytes; n += 16)
+	{
+		// each 16 bit lane holds a high nibble then a low nibble
+		__m128i a = _mm_loadu_si128((const __m128i*)(pNibbles + n * 2));
+		__m128i b = _mm_loadu_si128((const __m128i*)(pNibbles + n * 2 + 16));
+		a = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(a, low), 4), _mm_srli_epi16(a, 8));
+		b = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(b, low), 4), _mm_srli_epi16(b, 8));
+		_mm_storeu_si128((__m128i*)(pOut + n), _mm_packus_epi16(a, b));
+	}
+
+	HexPackScalar(pOut + n, pNibbles + n * 2, nBytes - n);
+}
+
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// AVX2 decoder, classifies 32 characters at a time and gathers with shuffles
+////////////////////////////////////////////////////////////////////////////////
+
+#ifdef HAVE_AVX2
+
+TARGET_AVX2 static inline __m256i InRange256(__m256i c, u8 lo, u8 hi)
+{
+	const __m256i bias = _mm256_set1_epi8((char)0x80);
+	const __m256i x = _mm256_xor_si256(c, bias);
+	return _mm256_and_si256(_mm256_cmpgt_epi8(x, _mm256_set1_epi8((char)((lo - 1) ^ 0x80))),
+							_mm256_cmpgt_epi8(_mm256_set1_epi8((char)((hi + 1) ^ 0x80)), x));
+}
+
+TARGET_AVX2 static s32 HexGatherAVX2(u8* pOut, const u8* pIn, u32 nLength)
+{
+	u8* out = pOut;
+	u32 n = 0;
+	for (; n + 32 <= nLength; n += 32)
+	{
+		const __m256i c = _mm256_loadu_si256((const __m256i*)(pIn + n));
+		const __m256i lower = _mm256_or_si256(c, _mm256_set1_epi8(0x20));
+		const __m256i digit = InRange256(c, '0', '9');
+		const __m256i alpha = InRange256(lower, 'a', 'f');
+		const __m256i space = _mm256_or_si256(	_mm256_or_si256(_mm256_cmpeq_epi8(c, _mm256_set1_epi8(' ')), _mm256_cmpeq_epi8(c, _mm256_setzero_si256())),
+												_mm256_or_si256(_mm256_cmpeq_epi8(c, _mm256_set1_epi8(9)),
+																_mm256_or_si256(_mm256_cmpeq_epi8(c, _mm256_set1_epi8(10)), _mm256_cmpeq_epi8(c, _mm256_set1_epi8(13)))));
+		const __m256i hex = _mm256_or_si256(digit, alpha);
+		if ((u32)_mm256_movemask_epi8(_mm256_or_si256(hex, space)) != 0xffffffff)
+		{
+			return -1;
+		}
+
+		const __m256i value = _mm256_or_si256(	_mm256_and_si256(digit, _mm256_sub_epi8(c, _mm256_set1_epi8('0'))),
+												_mm256_andnot_si256(digit, _mm256_sub_epi8(lower, _mm256_set1_epi8('a' - 10))));
+		const u32 mask = (u32)_mm256_movemask_epi8(hex);
+		if (mask == 0xffffffff)
+		{
+			// all hex, nothing to gather
+			_mm256_storeu_si256((__m256i*)out, value);
+			out += 32;
+		}
+		else
+		{
+			// gather each 8 byte group with a shuffle, out never passes the
+			// group being read
+			u8 temp[32];
+			_mm256_storeu_si256((__m256i*)temp, value);
+			for (u32 g = 0; g < 4; g++)
+			{
+				const u8 m = (u8)(mask >> (g * 8));
+				const __m128i v = _mm_loadl_epi64((const __m128i*)(temp + g * 8));
+				_mm_storel_epi64((__m128i*)out, _mm_shuffle_epi8(v, _mm_loadl_epi64((const __m128i*)gHex.gather[m])));
+				out += gHex.count[m];
+			}
+		}
+	}
+
+	s32 tail = HexGatherScalar(out, pIn + n, nLength - n);
+	return tail < 0 ? -1 : (s32)(out - pOut) + tail;
+}
+
+TARGET_AVX2 static void HexPackAVX2(u8* pOut, const u8* pNibbles, u32 nBytes)
+{
+	// multiply the high nibble by 16 and add the low one, then undo the lane
+	// interleave of the pack
+	const __m256i weights = _mm256_set1_epi16(0x0110);
+	u32 n = 0;
+	for (; n + 32 <= nBytes; n += 32)
+	{
+		__m256i a = _mm256_maddubs_epi16(_mm256_loadu_si256((const __m256i*)(pNibbles + n * 2)), weights);
+		__m256i b = _mm256_maddubs_epi16(_mm256_loadu_si256((const __m256i*)(pNibbles + n * 2 + 32)), weights);
+		_mm256_storeu_si256((__m256i*)(pOut + n), _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xd8));
+	}
+
+	HexPackScalar(pOut + n, pNibbles + n * 2, nBytes - n);
+}
+
+static bool CPUHasAVX2()
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7)
+	{
+		return false;
+	}
+
+	// the OS has to save the YMM registers as well
+	__cpuid(info, 1);
+	if (!(info[2] & (1 << 27)) || (_xgetbv(0) & 6) != 6)
+	{
+		return false;
+	}
+
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	return __builtin_cpu_supports("avx2") != 0;
+#endif
+}
+
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// Decoder selection
+////////////////////////////////////////////////////////////////////////////////
+
+bool HexDecoderAvailable(u8 decoder)
+{
+	switch (decoder)
+	{
+		case HEX_DECODER_SCALAR:
+			return true;
+#ifdef HAVE_SSE2
+		case HEX_DECODER_SSE2:
+			return true;
+#endif
+#ifdef HAVE_AVX2
+		case HEX_DECODER_AVX2:
+		{
+			static const bool bAVX2 = CPUHasAVX2();
+			return bAVX2;
+		}
+#endif
+	}
+	return false;
+}
+
+// SSE2 has no byte shuffle to gather with, and on one byte per line Efinix hex
+// it is no faster than scalar, so it is left to -hb to measure
+u8 HexBestDecoder()
+{
+	u8 decoder = HEX_DECODERS - 1;
+	while (!HexDecoderAvailable(decoder) || decoder == HEX_DECODER_SSE2) decoder--;
+	return decoder;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Decode whitespace separated hex text to binary in place, returns the number
+// of bytes or -1 if there is an invalid character (non-hex and non-whitespace)
+////////////////////////////////////////////////////////////////////////////////
+
+static s32 HexGather(u8 decoder, u8* pOut, const u8* pIn, u32 nLength)
+{
+	switch (decoder)
+	{
+#ifdef HAVE_AVX2
+		case HEX_DECODER_AVX2:
+			return HexGatherAVX2(pOut, pIn, nLength);
+#endif
+#ifdef HAVE_SSE2
+		case HEX_DECODER_SSE2:
+			return HexGatherSSE2(pOut, pIn, nLength);
+#endif
+	}
+	return HexGatherScalar(pOut, pIn, nLength);
+}
+
+static void HexPack(u8 decoder, u8* pOut, const u8* pNibbles, u32 nBytes)
+{
+	switch (decoder)
+	{
+#ifdef HAVE_AVX2
+		case HEX_DECODER_AVX2:
+			HexPackAVX2(pOut, pNibbles, nBytes);
+			return;
+#endif
+#ifdef HAVE_SSE2
+		case HEX_DECODER_SSE2:
+			HexPackSSE2(pOut, pNibbles, nBytes);
+			return;
+#endif
+	}
+	HexPackScalar(pOut, pNibbles, nBytes);
+}
+
+s32 HexDecodeWith(u8 decoder, u8* pBuffer, u32 nLength)
+{
+	// gather the nibbles to the front of the buffer, then pack pairs of them
+	s32 nibbles = HexGather(decoder, pBuffer, pBuffer, nLength);
+	if (nibbles > 0)
+	{
+		HexPack(decoder, pBuffer, pBuffer, nibbles >> 1);
+	}
+
+	return nibbles < 0 ? -1 : nibbles >> 1;
+}
+
+s32 HexDecode(u8* pBuffer, u32 nLength)
+{
+	static const u8 decoder = HexBestDecoder();
+	return HexDecodeWith(decoder, pBuffer, nLength);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Decode hex text that arrives in pieces, from a mapping or a stream. A nibble
+// left over at the end of one piece is carried into the next
+////////////////////////////////////////////////////////////////////////////////
+
+void HexStreamInit(HexStream* pStream)
+{
+	pStream->decoder = HexBestDecoder();
+	pStream->bNibble = false;
+	pStream->nibble = 0;
+}
+
+s32 HexStreamDecode(HexStream* pStream, u8* pOut, const u8* pIn, u32 nLength)
+{
+	u8 nibbles[HEX_CHUNK_SIZE + 1];
+	u8* out = pOut;
+
+	while (nLength)
+	{
+		const u32 len = nLength < HEX_CHUNK_SIZE ? nLength : HEX_CHUNK_SIZE;
+
+		// gather after any carried nibble
+		nibbles[0] = pStream->nibble;
+		const s32 gathered = HexGather(pStream->decoder, nibbles + pStream->bNibble, pIn, len);
+		if (gathered < 0)
+		{
+			return -1;
+		}
+
+		const u32 count = gathered + pStream->bNibble;
+		HexPack(pStream->decoder, out, nibbles, count >> 1);
+		out += count >> 1;
+
+		pStream->bNibble = (count & 1) != 0;
+		if (pStream->bNibble) pStream->nibble = nibbles[count - 1];
+
+		pIn += len;
+		nLength -= len;
+	}
+
+	return (s32)(out - pOut);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Load from a stream (pipe, stdin or anything we can't map), decoding as each
+// chunk is read and growing the image as needed
+////////////////////////////////////////////////////////////////////////////////
+
+static u8* HexLoadStream(FILE* f, s32* pSize)
+{
+	HexStream stream;
+	HexStreamInit(&stream);
+
+	u32 capacity = HEX_CHUNK_SIZE;
+	u32 size = 0;
+	u8* image = new u8[capacity];
+	u8 text[HEX_CHUNK_SIZE];
+
+	size_t read;
+	while ((read = fread(text, 1, sizeof(text), f)) > 0)
+	{
+		// a chunk never decodes to more than half its length plus a carried nibble
+		if (size + read / 2 + 1 > capacity)
+		{
+			while (size + read / 2 + 1 > capacity) capacity *= 2;
+			u8* grown = new u8[capacity];
+			memcpy(grown, image, size);
+			delete[] image;
+			image = grown;
+		}
+
+		const s32 decoded = HexStreamDecode(&stream, image + size, text, (u32)read);
+		if (decoded < 0)
+		{
+			delete[] image;
+			return 0;
+		}
+		size += decoded;
+	}
+
+	if (ferror(f))
+	{
+		delete[] image;
+		return 0;
+	}
+
+	*pSize = size;
+	return image;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Load from a memory mapping of the file, decoding straight out of the page
+// cache without any copies of the text
+////////////////////////////////////////////////////////////////////////////////
+
+#ifdef HAVE_MMAP
+
+static u8* HexLoadMapped(int fd, u32 nLength, s32* pSize)
+{
+	void* map = mmap(0, nLength, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED)
+	{
+		return 0;
+	}
+	madvise(map, nLength, MADV_SEQUENTIAL);
+
+	HexStream stream;
+	HexStreamInit(&stream);
+
+	u8* image = new u8[nLength / 2 + 1];
+	const s32 decoded = HexStreamDecode(&stream, image, (const u8*)map, nLength);
+	munmap(map, nLength);
+
+	if (decoded < 0)
+	{
+		delete[] image;
+		return 0;
+	}
+
+	*pSize = decoded;
+	return image;
+}
+
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// Load a whole hex file into memory in a single pass, returns 0 if it can't be
+// read or is corrupt, otherwise a buffer to be freed with delete[]. A filename
+// of - reads from stdin
+////////////////////////////////////////////////////////////////////////////////
+
+u8* HexLoad(const char* pFilename, s32* pSize)
+{
+	*pSize = -1;
+
+	if (strcmp(pFilename, "-") == 0)
+	{
+		return HexLoadStream(stdin, pSize);
+	}
+
+#ifdef HAVE_MMAP
+	// regular files are mapped, anything else (fifos, devices) is streamed
+	int fd = open(pFilename, O_RDONLY);
+	if (fd < 0)
+	{
+		return 0;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 && st.st_size <= 0x7fffffff)
+	{
+		u8* image = HexLoadMapped(fd, (u32)st.st_size, pSize);
+		close(fd);
+		return image;
+	}
+	close(fd);
+#endif
+
+	FILE* f;
+	if (fopen_s(&f, pFilename, "rb") != 0)
+	{
+		return 0;
+	}
+
+	u8* image = HexLoadStream(f, pSize);
+	fclose(f);
+	return image;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Raw binary, .bin or Efinix .bit (the same bitstream as the .hex, unencoded)
+////////////////////////////////////////////////////////////////////////////////
+
+static bool BinLoad(Image* pImage, const char* pFilename)
+{
+	FILE* f;
+	if (fopen_s(&f, pFilename, "rb") != 0)
+	{
+		return false;
+	}
+
+	bool bOk = false;
+	long nLength;
+	if (fseek(f, 0, SEEK_END) == 0 && (nLength = ftell(f)) > 0 && nLength <= IMAGE_MAX_SIZE && fseek(f, 0, SEEK_SET) == 0)
+	{
+		pImage->pData = new u8[nLength];
+		pImage->nSize = (u32)nLength;
+		bOk = fread(pImage->pData, 1, nLength, f) == (size_t)nLength;
+	}
+
+	fclose(f);
+	return bOk;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Efinix hex, whitespace separated hex digits
+////////////////////////////////////////////////////////////////////////////////
+
+static bool HexProbe(const u8* pHead, u32 nLength)
+{
+	bool bDigits = false;
+	for (u32 n = 0; n < nLength; n++)
+	{
+		const u8 v = gHex.value[pHead[n]];
+		if (v == HEX_INVALID) return false;
+		if (v < 16) bDigits = true;
+	}
+	return bDigits;
+}
+
+static bool HexLoadImage(Image* pImage, const char* pFilename)
+{
+	s32 size = 0;
+	pImage->pData = HexLoad(pFilename, &size);
+	pImage->nSize = size > 0 ? size : 0;
+	return pImage->pData && size > 0 && size <= IMAGE_MAX_SIZE;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Intel HEX, ":LLAAAATT<data>CC" records with extended address records. The
+// image covers the lowest to the highest address written, gaps are left blank
+////////////////////////////////////////////////////////////////////////////////
+
+#define IHEX_DATA				0x00
+#define IHEX_END				0x01
+#define IHEX_SEGMENT_ADDRESS	0x02
+#define IHEX_LINEAR_ADDRESS		0x04
+
+static bool IHexProbe(const u8* pHead, u32 nLength)
+{
+	for (u32 n = 0; n < nLength; n++)
+	{
+		if (gHex.value[pHead[n]] != HEX_SPACE) return pHead[n] == ':';
+	}
+	return false;
+}
+
+// parse all records, finding the address range if pImage is 0 or filling it in
+static bool IHexParse(const u8* pText, u32 nLength, Image* pImage, u32 nBase, u32* pLow, u32* pHigh)
+{
+	u32 upper = 0;
+	u32 n = 0;
+	while (n < nLength)
+	{
+		// skip to the next record
+		const u8 v = gHex.value[pText[n]];
+		if (v == HEX_SPACE)
+		{
+			n++;
+			continue;
+		}
+		if (pText[n++] != ':')
+		{
+			return false;
+		}
+
+		// decode the record bytes and check the sum
+		u8 record[5 + 255];
+		u32 nBytes = 0;
+		u8 sum = 0;
+		while (n + 1 < nLength && nBytes < sizeof(record))
+		{
+			const u8 hi = gHex.value[pText[n]];
+			const u8 lo = gHex.value[pText[n + 1]];
+			if (hi >= 16 || lo >= 16) break;
+			sum += record[nBytes++] = (hi << 4) | lo;
+			n += 2;
+		}
+		if (nBytes < 5 || nBytes != 5u + record[0] || sum != 0)
+		{
+			return false;
+		}
+
+		const u32 len = record[0];
+		const u32 addr = upper + ((record[1] << 8) | record[2]);
+		switch (record[3])
+		{
+			case IHEX_DATA:
+				if (!len) break;
+				if (pImage)
+				{
+					memcpy(pImage->pData + addr - nBase, record + 4, len);
+					ImageAddRegion(pImage, addr - nBase, len);
+				}
+				else
+				{
+					if (addr < *pLow) *pLow = addr;
+					if (addr + len > *pHigh) *pHigh = addr + len;
+				}
+				break;
+
+			case IHEX_END:
+				return true;
+
+			case IHEX_SEGMENT_ADDRESS:
+				if (len != 2) return false;
+				upper = ((record[4] << 8) | record[5]) << 4;
+				break;
+
+			case IHEX_LINEAR_ADDRESS:
+				if (len != 2) return false;
+				upper = ((record[4] << 8) | record[5]) << 16;
+				break;
+
+			default:
+				// start addresses mean nothing to a flash
+				break;
+		}
+	}
+
+	return true;
+}
+
+static bool IHexLoad(Image* pImage, const char* pFilename)
+{
+	u32 nLength = 0;
+	u8* text = 0;
+	FILE* f;
+	if (fopen_s(&f, pFilename, "rb") == 0)
+	{
+		long len;
+		if (fseek(f, 0, SEEK_END) == 0 && (len = ftell(f)) > 0 && fseek(f, 0, SEEK_SET) == 0)
+		{
+			text = new u8[len];
+			if (fread(text, 1, len, f) == (size_t)len) nLength = (u32)len;
+		}
+		fclose(f);
+	}
+
+	u32 low = ~0u;
+	u32 high = 0;
+	bool bOk = nLength && IHexParse(text, nLength, 0, 0, &low, &high) && high > low && high - low <= IMAGE_MAX_SIZE;
+	if (bOk)
+	{
+		pImage->pData = new u8[high - low];
+		pImage->nSize = high - low;
+		pImage->nAddress += low;
+		memset(pImage->pData, 0xff, pImage->nSize);
+		bOk = IHexParse(text, nLength, pImage, low, &low, &high);
+	}
+
+	delete[] text;
+	return bOk;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Image formats, picked by extension then by looking at the start of the file
+////////////////////////////////////////////////////////////////////////////////
+
+struct ImageFormat
+{
+	const char* pExtensions;					// space separated
+	bool (*Probe)(const u8* pHead, u32 nLength);
+	bool (*Load)(Image* pImage, const char* pFilename);
+};
+
+// in order of preference, names are in gImageFormatNames
+static const ImageFormat gImageFormats[IMAGE_FORMATS] =
+{
+	{ "",					0,			0 },
+	{ "hex",				HexProbe,	HexLoadImage },
+	{ "hex ihex mcs",		IHexProbe,	IHexLoad },
+	{ "bit",				0,			BinLoad },
+	{ "bin",				0,			BinLoad },
+};
+
+const char* gImageFormatNames[IMAGE_FORMATS] = { "Unknown", "Efinix hex", "Intel HEX", "Efinix bit", "Binary" };
+
+static bool ExtensionMatches(const char* pFilename, const char* pExtensions)
+{
+	const char* ext = strrchr(pFilename, '.');
+	if (!ext || strpbrk(ext, "/\\"))
+	{
+		return false;
+	}
+	ext++;
+
+	const size_t len = strlen(ext);
+	for (const char* p = pExtensions; *p; )
+	{
+		const char* end = strchr(p, ' ');
+		const size_t n = end ? (size_t)(end - p) : strlen(p);
+		if (n == len && _strnicmp(p, ext, n) == 0) return true;
+		p += n;
+		while (*p == ' ') p++;
+	}
+	return false;
+}
+
+u8 ImageDetectFormat(const char* pFilename)
+{
+	// streams can't be looked at without using them up, so they're always Efinix hex
+	if (ImageIsStream(pFilename))
+	{
+		return IMAGE_FORMAT_HEX;
+	}
+
+	u8 head[IMAGE_PROBE_SIZE];
+	u32 nHead = 0;
+	FILE* f;
+	if (fopen_s(&f, pFilename, "rb") != 0)
+	{
+		return IMAGE_FORMAT_UNKNOWN;
+	}
+	nHead = (u32)fread(head, 1, sizeof(head), f);
+	fclose(f);
+
+	// an extension that matches, preferring one whose contents also match
+	u8 byExtension = IMAGE_FORMAT_UNKNOWN;
+	for (u8 n = 1; n < IMAGE_FORMATS; n++)
+	{
+		const ImageFormat* fmt = &gImageFormats[n];
+		if (ExtensionMatches(pFilename, fmt->pExtensions))
+		{
+			if (!fmt->Probe || fmt->Probe(head, nHead)) return n;
+			if (!byExtension) byExtension = n;
+		}
+	}
+	if (byExtension)
+	{
+		return byExtension;
+	}
+
+	// otherwise go by the contents, anything unrecognised is binary
+	for (u8 n = 1; n < IMAGE_FORMATS; n++)
+	{
+		const ImageFormat* fmt = &gImageFormats[n];
+		if (fmt->Probe && fmt->Probe(head, nHead)) return n;
+	}
+	return IMAGE_FORMAT_BIN;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Streams, stdin (-) or anything that isn't a regular file, can only be read
+// once and may not have an end yet
+////////////////////////////////////////////////////////////////////////////////
+
+bool ImageIsStream(const char* pFilename)
+{
+	if (strcmp(pFilename, "-") == 0)
+	{
+		return true;
+	}
+
+#ifdef HAVE_MMAP
+	struct stat st;
+	return stat(pFilename, &st) == 0 && !S_ISREG(st.st_mode);
+#else
+	return false;
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Load an image in any format, nAddress is where it goes in flash (added to
+// the addresses in formats that have them)
+////////////////////////////////////////////////////////////////////////////////
+
+bool ImageLoad(Image* pImage, const char* pFilename, u32 nAddress)
+{
+	pImage->pData = 0;
+	pImage->nSize = 0;
+	pImage->nAddress = nAddress;
+	pImage->nRegions = 0;
+	pImage->nFormat = ImageDetectFormat(pFilename);
+
+	if (pImage->nFormat == IMAGE_FORMAT_UNKNOWN || !gImageFormats[pImage->nFormat].Load(pImage, pFilename))
+	{
+		ImageFree(pImage);
+		return false;
+	}
+
+	// formats without addresses are a single region
+	if (!pImage->nRegions)
+	{
+		ImageAddRegion(pImage, 0, pImage->nSize);
+	}
+
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Regions, the parts of an image that hold data. They are kept in address
+// order and joined when they touch, a full list joins the new region to its
+// neighbour, filling the gap between them with the blank 0xff
+////////////////////////////////////////////////////////////////////////////////
+
+void ImageAddRegion(Image* pImage, u32 nOffset, u32 nSize)
+{
+	ImageRegion* r = pImage->regions;
+	u32 nEnd = nOffset + nSize;
+
+	// find where it goes
+	u32 n = 0;
+	while (n < pImage->nRegions && r[n].nOffset + r[n].nSize < nOffset) n++;
+
+	// no room, so it joins the region before it (or after if there isn't one)
+	if (pImage->nRegions == IMAGE_MAX_REGIONS && (n == pImage->nRegions || nEnd < r[n].nOffset))
+	{
+		if (n) n--;
+		if (r[n].nOffset < nOffset) nOffset = r[n].nOffset;
+		if (r[n].nOffset + r[n].nSize > nEnd) nEnd = r[n].nOffset + r[n].nSize;
+		r[n].nOffset = nOffset;
+		r[n].nSize = nEnd - nOffset;
+	}
+
+	// separate, insert it
+	else if (n == pImage->nRegions || nEnd < r[n].nOffset)
+	{
+		memmove(&r[n + 1], &r[n], (pImage->nRegions - n) * sizeof(ImageRegion));
+		r[n].nOffset = nOffset;
+		r[n].nSize = nSize;
+		pImage->nRegions++;
+		return;
+	}
+
+	// touching or overlapping, extend it
+	else
+	{
+		if (r[n].nOffset < nOffset) nOffset = r[n].nOffset;
+		if (r[n].nOffset + r[n].nSize > nEnd) nEnd = r[n].nOffset + r[n].nSize;
+		r[n].nOffset = nOffset;
+		r[n].nSize = nEnd - nOffset;
+	}
+
+	// it may now reach the ones after it
+	while (n + 1 < pImage->nRegions && r[n + 1].nOffset <= r[n].nOffset + r[n].nSize)
+	{
+		const u32 nNextEnd = r[n + 1].nOffset + r[n + 1].nSize;
+		if (nNextEnd > r[n].nOffset + r[n].nSize) r[n].nSize = nNextEnd - r[n].nOffset;
+		memmove(&r[n + 1], &r[n + 2], (pImage->nRegions - n - 2) * sizeof(ImageRegion));
+		pImage->nRegions--;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Merge another image into this one, so several files can be programmed in
+// one go. Fails if any of their regions overlap, pOther is freed either way
+////////////////////////////////////////////////////////////////////////////////
+
+bool ImageMerge(Image* pImage, Image* pOther)
+{
+	// check nothing is written twice
+	for (u32 a = 0; a < pImage->nRegions; a++)
+	{
+		const u32 aStart = pImage->nAddress + pImage->regions[a].nOffset;
+		const u32 aEnd = aStart + pImage->regions[a].nSize;
+		for (u32 b = 0; b < pOther->nRegions; b++)
+		{
+			const u32 bStart = pOther->nAddress + pOther->regions[b].nOffset;
+			const u32 bEnd = bStart + pOther->regions[b].nSize;
+			if (aStart < bEnd && bStart < aEnd)
+			{
+				ImageFree(pOther);
+				return false;
+			}
+		}
+	}
+
+	// span both, with the space between them blank
+	const u32 nStart = pImage->nAddress < pOther->nAddress ? pImage->nAddress : pOther->nAddress;
+	const u32 nEndA = pImage->nAddress + pImage->nSize;
+	const u32 nEndB = pOther->nAddress + pOther->nSize;
+	const u32 nEnd = nEndA > nEndB ? nEndA : nEndB;
+	if (nEnd - nStart > IMAGE_MAX_SIZE)
+	{
+		ImageFree(pOther);
+		return false;
+	}
+
+	Image merged;
+	merged.pData = new u8[nEnd - nStart];
+	merged.nAddress = nStart;
+	merged.nSize = nEnd - nStart;
+	merged.nFormat = pImage->nFormat;
+	merged.nRegions = 0;
+	memset(merged.pData, 0xff, merged.nSize);
+
+	const Image* sources[2] = { pImage, pOther };
+	for (u32 i = 0; i < 2; i++)
+	{
+		const Image* src = sources[i];
+		for (u32 n = 0; n < src->nRegions; n++)
+		{
+			const u32 nOffset = src->nAddress - nStart + src->regions[n].nOffset;
+			memcpy(merged.pData + nOffset, src->pData + src->regions[n].nOffset, src->regions[n].nSize);
+			ImageAddRegion(&merged, nOffset, src->regions[n].nSize);
+		}
+	}
+
+	ImageFree(pImage);
+	ImageFree(pOther);
+	*pImage = merged;
+	return true;
+}
+
+void ImageFree(Image* pImage)
+{
+	delete[] pImage->pData;
+	pImage->pData = 0;
+	pImage->nSize = 0;
+	pImage->nRegions = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Streamed images, a reader thread decodes the input into a bounded ring as it
+// arrives so programming can start straight away and memory use doesn't
+// depend on the image size. Efinix hex is decoded and anything else is taken
+// as raw binary, except Intel HEX, whose records can go anywhere and so can't
+// be written in the order they arrive. The input is read without stdio and
+// only once there is something to read, so a write that fails part way can
+// stop the reader without waiting for the other end of a pipe to close
+////////////////////////////////////////////////////////////////////////////////
+
+struct ImageStream
+{
+	FILE* f;
+	std::thread reader;
+	std::mutex lock;
+	std::condition_variable changed;
+	u8 head[HEX_CHUNK_SIZE];					// first piece, read to pick the format
+	u32 nHead;
+	bool bHex;
+	u8 ring[IMAGE_STREAM_RING];
+	u64 nWritten;								// totals, so the ring position is mod the size
+	u64 nRead;
+	bool bEnd;
+	bool bError;
+	bool bStop;
+};
+
+static bool ImageStreamStopping(ImageStream* s)
+{
+	std::lock_guard<std::mutex> guard(s->lock);
+	return s->bStop;
+}
+
+// read what has arrived, up to nMax bytes, returns 0 at the end or once told
+// to stop and -1 on an error
+static s32 ImageStreamInput(ImageStream* s, u8* pOut, u32 nMax)
+{
+#ifdef _WIN32
+	// only pipes can be asked if there is anything waiting
+	const HANDLE h = (HANDLE)_get_osfhandle(_fileno(s->f));
+	DWORD got = 0;
+	if (GetFileType(h) != FILE_TYPE_PIPE)
+	{
+		return ReadFile(h, pOut, nMax, &got, 0) ? (s32)got : -1;
+	}
+
+	while (!ImageStreamStopping(s))
+	{
+		DWORD waiting = 0;
+		if (!PeekNamedPipe(h, 0, 0, 0, &waiting, 0))
+		{
+			return GetLastError() == ERROR_BROKEN_PIPE ? 0 : -1;
+		}
+		if (waiting)
+		{
+			return ReadFile(h, pOut, waiting < nMax ? waiting : nMax, &got, 0) ? (s32)got : -1;
+		}
+		Sleep(IMAGE_STREAM_POLL_MS);
+	}
+	return 0;
+#else
+	const int fd = fileno(s->f);
+	while (!ImageStreamStopping(s))
+	{
+		struct pollfd p = { fd, POLLIN, 0 };
+		const int ready = poll(&p, 1, IMAGE_STREAM_POLL_MS);
+		if (ready < 0 && errno != EINTR)
+		{
+			return -1;
+		}
+		if (ready > 0)
+		{
+			const ssize_t got = read(fd, pOut, nMax);
+			if (got >= 0) return (s32)got;
+			if (errno != EINTR && errno != EAGAIN) return -1;
+		}
+	}
+	return 0;
+#endif
+}
+
+static void ImageStreamReader(ImageStream* s)
+{
+	u8 text[HEX_CHUNK_SIZE];
+	u8 data[HEX_CHUNK_SIZE];
+
+	HexStream hex;
+	HexStreamInit(&hex);
+	bool bError = false;
+
+	s32 read = (s32)s->nHead;
+	const u8* pText = s->head;
+	while (read > 0)
+	{
+		const u8* pData = pText;
+		s32 size = (s32)read;
+		if (s->bHex)
+		{
+			pData = data;
+			size = HexStreamDecode(&hex, data, pText, (u32)read);
+		}
+		if (size < 0)
+		{
+			bError = true;
+			break;
+		}
+
+		// copy it into the ring as space frees up
+		u32 done = 0;
+		while (done < (u32)size)
+		{
+			std::unique_lock<std::mutex> guard(s->lock);
+			s->changed.wait(guard, [s] { return s->bStop || s->nWritten - s->nRead < IMAGE_STREAM_RING; });
+			if (s->bStop)
+			{
+				return;
+			}
+
+			const u32 pos = (u32)(s->nWritten % IMAGE_STREAM_RING);
+			u32 len = IMAGE_STREAM_RING - (u32)(s->nWritten - s->nRead);
+			if (len > IMAGE_STREAM_RING - pos) len = IMAGE_STREAM_RING - pos;
+			if (len > size - done) len = size - done;
+			memcpy(s->ring + pos, pData + done, len);
+			s->nWritten += len;
+			done += len;
+			s->changed.notify_all();
+		}
+
+		{
+			std::lock_guard<std::mutex> guard(s->lock);
+			if (s->bStop)
+			{
+				return;
+			}
+		}
+
+		read = ImageStreamInput(s, text, sizeof(text));
+		pText = text;
+	}
+
+	std::lock_guard<std::mutex> guard(s->lock);
+	s->bError = bError || read < 0;
+	s->bEnd = true;
+	s->changed.notify_all();
+}
+
+// waits for the start of the input to see what it is, *pFormat is set even if
+// the stream can't be used
+ImageStream* ImageStreamOpen(const char* pFilename, u8* pFormat)
+{
+	*pFormat = IMAGE_FORMAT_UNKNOWN;
+	FILE* f = stdin;
+	if (strcmp(pFilename, "-") != 0 && fopen_s(&f, pFilename, "rb") != 0)
+	{
+		return 0;
+	}
+
+	// enough of the start to tell the format
+	ImageStream* s = new ImageStream;
+	s->f = f;
+	s->bStop = false;
+	s->nHead = 0;
+	s32 got;
+	while (s->nHead < IMAGE_PROBE_SIZE && (got = ImageStreamInput(s, s->head + s->nHead, sizeof(s->head) - s->nHead)) > 0)
+	{
+		s->nHead += got;
+	}
+	const u32 nProbe = s->nHead < IMAGE_PROBE_SIZE ? s->nHead : IMAGE_PROBE_SIZE;
+	s->bHex = HexProbe(s->head, nProbe);
+	*pFormat = s->bHex ? IMAGE_FORMAT_HEX : IHexProbe(s->head, nProbe) ? IMAGE_FORMAT_IHEX : IMAGE_FORMAT_BIN;
+	if (*pFormat == IMAGE_FORMAT_IHEX)
+	{
+		if (f != stdin) fclose(f);
+		delete s;
+		return 0;
+	}
+
+	s->nWritten = 0;
+	s->nRead = 0;
+	s->bEnd = false;
+	s->bError = false;
+	s->bStop = false;
+	s->reader = std::thread(ImageStreamReader, s);
+	return s;
+}
+
+// read up to nMax bytes, waiting for them to arrive, returns less only at the end
+u32 ImageStreamRead(ImageStream* s, u8* pOut, u32 nMax)
+{
+	u32 done = 0;
+	std::unique_lock<std::mutex> guard(s->lock);
+	while (done < nMax)
+	{
+		s->changed.wait(guard, [s] { return s->bEnd || s->nWritten != s->nRead; });
+		if (s->nWritten == s->nRead)
+		{
+			break;
+		}
+
+		const u32 pos = (u32)(s->nRead % IMAGE_STREAM_RING);
+		u32 len = (u32)(s->nWritten - s->nRead);
+		if (len > IMAGE_STREAM_RING - pos) len = IMAGE_STREAM_RING - pos;
+		if (len > nMax - done) len = nMax - done;
+		memcpy(pOut + done, s->ring + pos, len);
+		s->nRead += len;
+		done += len;
+		s->changed.notify_all();
+	}
+	return done;
+}
+
+// returns false if the input couldn't be read or wasn't valid
+bool ImageStreamClose(ImageStream* s)
+{
+	{
+		std::lock_guard<std::mutex> guard(s->lock);
+		s->bStop = true;
+		s->changed.notify_all();
+	}
+	s->reader.join();
+
+	const bool bOk = !s->bError;
+	if (s->f != stdin)
+	{
+		fclose(s->f);
+	}
+	delete s;
+	return bOk;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Check a stream can be closed while its input is still open and has nothing
+// more to give, as when a write fails part way through a pipe. A pipe is fed
+// a little hex and left open, and the close has to come back by itself
+////////////////////////////////////////////////////////////////////////////////
+
+bool ImageStreamSelfTest()
+{
+	printf("Checking a stream closes with its input still open... ");
+	fflush(stdout);
+
+#ifdef _WIN32
+	printf("not supported\n");
+	return true;
+#else
+	int fds[2];
+	if (pipe(fds) != 0)
+	{
+		printf("FAILED! (no pipe)\n");
+		return false;
+	}
+
+	char text[IMAGE_PROBE_SIZE * 2];
+	for (u32 n = 0; n + 3 <= sizeof(text); n += 3) memcpy(text + n, "a5\n", 3);
+	const u32 nText = (sizeof(text) / 3) * 3;
+	bool bOk = write(fds[1], text, nText) == (ssize_t)nText;
+
+	char name[32];
+	snprintf(name, sizeof(name), "/dev/fd/%d", fds[0]);
+	u8 format;
+	ImageStream* stream = bOk ? ImageStreamOpen(name, &format) : 0;
+	if (stream)
+	{
+		u8 data[16];
+		bOk = ImageStreamRead(stream, data, sizeof(data)) == sizeof(data) && data[0] == 0xa5;
+
+		// close it while the reader is waiting, closing the pipe too if it
+		// doesn't come back so a failure doesn't hang here
+		std::mutex lock;
+		std::condition_variable changed;
+		bool bClosed = false;
+		std::thread closer([&] {
+			ImageStreamClose(stream);
+			std::lock_guard<std::mutex> guard(lock);
+			bClosed = true;
+			changed.notify_all();
+		});
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			bOk = changed.wait_for(guard, std::chrono::milliseconds(IMAGE_STREAM_POLL_MS * 20), [&] { return bClosed; }) && bOk;
+		}
+		close(fds[1]);
+		closer.join();
+	}
+	else
+	{
+		close(fds[1]);
+		bOk = false;
+	}
+	close(fds[0]);
+
+	printf(bOk ? "OK!\n" : "FAILED!\n");
+	return bOk;
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Benchmark the decoders against the original fgetc parser on a hex file
+////////////////////////////////////////////////////////////////////////////////
+
+static u64 BenchMicroseconds()
+{
+	return (u64)std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void HexBenchmark(const char* pFilename)
+{
+	// the reference, parsing the file with fgetc as the original loader did
+	s32 hexSize = -1;
+	u8* reference = 0;
+	u64 referenceUs = ~0ull;
+	for (u32 run = 0; run < HEX_BENCH_RUNS; run++)
+	{
+		const u64 start = BenchMicroseconds();
+		hexSize = HexGetSize(pFilename);
+		FILE* f;
+		if (hexSize < 0 || fopen_s(&f, pFilename, "rt") != 0)
+		{
+			printf("Hex file corrupt (%s).\n", pFilename);
+			delete[] reference;
+			return;
+		}
+		if (!reference) reference = new u8[hexSize > 0 ? hexSize : 1];
+		HexGetBytes(reference, f, hexSize);
+		fclose(f);
+		const u64 elapsed = BenchMicroseconds() - start;
+		if (elapsed < referenceUs) referenceUs = elapsed;
+	}
+
+	// the decoders work on the text in memory
+	u8* text = 0;
+	s32 nLength = -1;
+	FILE* f;
+	if (fopen_s(&f, pFilename, "rb") == 0)
+	{
+		if (fseek(f, 0, SEEK_END) == 0 && (nLength = ftell(f)) >= 0 && fseek(f, 0, SEEK_SET) == 0)
+		{
+			text = new u8[nLength > 0 ? nLength : 1];
+			if (fread(text, 1, nLength, f) != (size_t)nLength) nLength = -1;
+		}
+		fclose(f);
+	}
+	if (nLength < 0)
+	{
+		printf("Unable to read %s.\n", pFilename);
+		delete[] text;
+		delete[] reference;
+		return;
+	}
+
+	printf("Hex decode of %s (%dKB text, %dKB binary), best of %d runs:\n", pFilename, nLength / 1024, hexSize / 1024, HEX_BENCH_RUNS);
+	printf("  %-16s %8.2fMB/s  1.00x\n", "fgetc", referenceUs ? (double)nLength / referenceUs : 0.0);
+
+	u8* work = new u8[nLength > 0 ? nLength : 1];
+	for (u8 decoder = 0; decoder < HEX_DECODERS; decoder++)
+	{
+		if (!HexDecoderAvailable(decoder))
+		{
+			printf("  %-16s not supported\n", gHexDecoderNames[decoder]);
+			continue;
+		}
+
+		s32 size = -1;
+		u64 best = ~0ull;
+		for (u32 run = 0; run < HEX_BENCH_RUNS; run++)
+		{
+			memcpy(work, text, nLength);
+			const u64 start = BenchMicroseconds();
+			size = HexDecodeWith(decoder, work, nLength);
+			const u64 elapsed = BenchMicroseconds() - start;
+			if (elapsed < best) best = elapsed;
+		}
+
+		const bool bOk = size == hexSize && memcmp(work, reference, hexSize) == 0;
+		printf("  %-16s %8.2fMB/s  %5.2fx  %s\n", gHexDecoderNames[decoder], best ? (double)nLength / best : 0.0,
+			best ? (double)referenceUs / best : 0.0, bOk ? "OK!" : "MISMATCH!");
+	}
+
+	delete[] work;
+	delete[] text;
+	delete[] reference;
+}
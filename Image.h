@@ -0,0 +1,85 @@
+#ifndef _IMAGE_H_
+#define _IMAGE_H_
+
+#include <stdio.h>
+#include "Types.h"
+
+#define HEX_DECODER_SCALAR		0
+#define HEX_DECODER_SSE2		1
+#define HEX_DECODER_AVX2		2
+#define HEX_DECODERS			3
+
+#define IMAGE_FORMAT_UNKNOWN	0
+#define IMAGE_FORMAT_HEX		1			// Efinix hex
+#define IMAGE_FORMAT_IHEX		2			// Intel HEX
+#define IMAGE_FORMAT_BIT		3			// Efinix bit
+#define IMAGE_FORMAT_BIN		4
+#define IMAGE_FORMATS			5
+
+#define IMAGE_MAX_SIZE			0x1000000	// 24 bit flash addresses
+#define IMAGE_PROBE_SIZE		256			// bytes looked at to detect the format
+#define IMAGE_MAX_REGIONS		32
+#define IMAGE_STREAM_RING		0x40000		// decoded bytes buffered ahead of a streamed write
+#define IMAGE_STREAM_POLL_MS	50			// how often a waiting reader checks it should stop
+
+#define HEX_CHUNK_SIZE			16384		// text decoded per step when mapped or streamed
+
+extern const char* gHexDecoderNames[HEX_DECODERS];
+extern const char* gImageFormatNames[IMAGE_FORMATS];
+
+struct ImageStream;
+
+struct ImageRegion
+{
+	u32 nOffset;								// from the start of the image
+	u32 nSize;
+};
+
+struct Image
+{
+	u8* pData;
+	u32 nAddress;								// flash address of the first byte
+	u32 nSize;
+	u8 nFormat;
+	u32 nRegions;								// parts holding data, anything else is left alone
+	ImageRegion regions[IMAGE_MAX_REGIONS];
+};
+
+struct HexStream
+{
+	u8 decoder;
+	bool bNibble;								// a nibble is carried to the next piece
+	u8 nibble;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Hex file parsing
+////////////////////////////////////////////////////////////////////////////////
+
+s32 HexGetSize(const char* pFilename);
+u32 HexGetBytes(void* buf, FILE* f, u32 size);
+bool HexDecoderAvailable(u8 decoder);
+u8 HexBestDecoder();
+s32 HexDecodeWith(u8 decoder, u8* pBuffer, u32 nLength);
+s32 HexDecode(u8* pBuffer, u32 nLength);
+void HexStreamInit(HexStream* pStream);
+s32 HexStreamDecode(HexStream* pStream, u8* pOut, const u8* pIn, u32 nLength);
+u8* HexLoad(const char* pFilename, s32* pSize);
+void HexBenchmark(const char* pFilename);
+
+////////////////////////////////////////////////////////////////////////////////
+// Images in any format
+////////////////////////////////////////////////////////////////////////////////
+
+u8 ImageDetectFormat(const char* pFilename);
+bool ImageLoad(Image* pImage, const char* pFilename, u32 nAddress);
+void ImageFree(Image* pImage);
+void ImageAddRegion(Image* pImage, u32 nOffset, u32 nSize);
+bool ImageMerge(Image* pImage, Image* pOther);
+bool ImageIsStream(const char* pFilename);
+ImageStream* ImageStreamOpen(const char* pFilename, u8* pFormat);
+u32 ImageStreamRead(ImageStream* pStream, u8* pOut, u32 nMax);
+bool ImageStreamClose(ImageStream* pStream);
+bool ImageStreamSelfTest();
+
+#endif // _IMAGE_H_
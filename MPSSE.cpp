@@ -0,0 +1,357 @@
+#include <stdio.h>
+#include <string.h>
+#include "ftdi.h"
+#include "MPSSE.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Clock planning
+////////////////////////////////////////////////////////////////////////////////
+
+u32 MPSSEClockFrequency(bool bDiv5, u16 nDivisor)
+{
+	return (bDiv5 ? MPSSE_CLOCK_BASE_DIV5 : MPSSE_CLOCK_BASE) / (((u32)nDivisor + 1) * 2);
+}
+
+MPSSEClock MPSSEPlanClock(u32 nRequested)
+{
+	if (nRequested < MPSSE_CLOCK_MIN) nRequested = MPSSE_CLOCK_MIN;
+
+	// smallest divisor that doesn't go over, from the 60Mhz base if it can
+	// reach as it has five times the resolution
+	MPSSEClock clock;
+	u32 divisor = (MPSSE_CLOCK_BASE + nRequested * 2 - 1) / (nRequested * 2);
+	clock.bDiv5 = divisor > 65536;
+	if (clock.bDiv5)
+	{
+		divisor = (MPSSE_CLOCK_BASE_DIV5 + nRequested * 2 - 1) / (nRequested * 2);
+		if (divisor > 65536) divisor = 65536;
+	}
+	if (divisor < 1) divisor = 1;
+
+	clock.nDivisor = (u16)(divisor - 1);
+	clock.nFrequency = MPSSEClockFrequency(clock.bDiv5, clock.nDivisor);
+	return clock;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Plan every rate up to twice the fastest and check each clock is at or under
+// the request (exactly, not as rounded to Hz), is the fastest that is,
+// reports the frequency it gives, and only uses the prescaler when the 60Mhz
+// base can't get that slow. Rates below the slowest clock get the slowest
+////////////////////////////////////////////////////////////////////////////////
+
+#define CLOCK_TEST_MAX_ERRORS			8			// reported before giving up
+
+bool MPSSEClockSelfTest()
+{
+	printf("Checking clock planning (1-%dHz)... ", MPSSE_CLOCK_MAX * 2);
+	fflush(stdout);
+
+	u32 nErrors = 0;
+	for (u32 nRequested = 1; nRequested <= MPSSE_CLOCK_MAX * 2 && nErrors < CLOCK_TEST_MAX_ERRORS; nRequested++)
+	{
+		const MPSSEClock clock = MPSSEPlanClock(nRequested);
+		const u64 base = clock.bDiv5 ? MPSSE_CLOCK_BASE_DIV5 : MPSSE_CLOCK_BASE;
+		const bool bNeedDiv5 = (u64)nRequested * 65536 * 2 < MPSSE_CLOCK_BASE;
+		const bool bTooSlow = (u64)nRequested * 65536 * 2 < MPSSE_CLOCK_BASE_DIV5;
+
+		const char* pError = 0;
+		if (bTooSlow)
+		{
+			if (!clock.bDiv5 || clock.nDivisor != 65535) pError = "not the slowest clock";
+		}
+		else if (base > (u64)nRequested * 2 * (clock.nDivisor + 1)) pError = "above the request";
+		else if (clock.nDivisor && base <= (u64)nRequested * 2 * clock.nDivisor) pError = "not the fastest";
+		if (!pError && clock.nFrequency != MPSSEClockFrequency(clock.bDiv5, clock.nDivisor)) pError = "frequency doesn't match the divisor";
+		if (!pError && clock.bDiv5 != bNeedDiv5) pError = clock.bDiv5 ? "prescaler used when not needed" : "prescaler needed";
+		if (pError)
+		{
+			if (!nErrors) printf("FAILED!\n");
+			printf("  %uHz: %s (div5 %s, divisor %u, %uHz)\n", nRequested, pError, clock.bDiv5 ? "on" : "off", clock.nDivisor, clock.nFrequency);
+			nErrors++;
+		}
+	}
+
+	if (!nErrors) printf("OK!\n");
+	return nErrors == 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// MPSSE command builder
+////////////////////////////////////////////////////////////////////////////////
+
+MPSSECommands::MPSSECommands()
+	: m_pArena(0)
+	, m_nCapacity(0)
+	, m_nSize(0)
+	, m_pRead(0)
+	, m_nReadCapacity(0)
+	, m_nReadSize(0)
+	, m_nSlices(0)
+	, m_bOverflow(false)
+	, m_nPins(0xff)
+	, m_nDirection(0)
+	, m_nSelect(0)
+{
+}
+
+MPSSECommands::~MPSSECommands()
+{
+	delete[] m_pArena;
+	delete[] m_pRead;
+}
+
+void MPSSECommands::Begin(u8 nPins, u8 nDirection, u8 nSelect)
+{
+	m_nSize = 0;
+	m_nReadSize = 0;
+	m_nSlices = 0;
+	m_bOverflow = false;
+	m_nPins = nPins;
+	m_nDirection = nDirection;
+	m_nSelect = nSelect;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Arena, only ever grows so a session settles on a size and stops allocating
+////////////////////////////////////////////////////////////////////////////////
+
+u8* MPSSECommands::Reserve(u32 nBytes)
+{
+	if (m_nSize + nBytes > m_nCapacity)
+	{
+		u32 capacity = m_nCapacity ? m_nCapacity : MPSSE_ARENA_SIZE;
+		while (m_nSize + nBytes > capacity) capacity *= 2;
+
+		u8* arena = new u8[capacity];
+		memcpy(arena, m_pArena, m_nSize);
+		delete[] m_pArena;
+		m_pArena = arena;
+		m_nCapacity = capacity;
+	}
+
+	u8* ptr = m_pArena + m_nSize;
+	m_nSize += nBytes;
+	return ptr;
+}
+
+void MPSSECommands::AddSlice(void* pDest, u32 nSize)
+{
+	// join on to the last slice if it carries straight on
+	MPSSESlice* last = m_nSlices ? &m_slices[m_nSlices - 1] : 0;
+	if (last && ((last->pDest == 0 && pDest == 0) || (last->pDest && (u8*)last->pDest + last->nSize == pDest)))
+	{
+		last->nSize += nSize;
+	}
+	else if (m_nSlices < MPSSE_MAX_SLICES)
+	{
+		m_slices[m_nSlices].pDest = pDest;
+		m_slices[m_nSlices].nSize = nSize;
+		m_nSlices++;
+	}
+	else
+	{
+		m_bOverflow = true;
+	}
+
+	m_nReadSize += nSize;
+}
+
+u8* MPSSECommands::ReadBuffer()
+{
+	if (m_nReadSize > m_nReadCapacity)
+	{
+		delete[] m_pRead;
+		m_nReadCapacity = m_nReadSize > MPSSE_ARENA_SIZE ? m_nReadSize : MPSSE_ARENA_SIZE;
+		m_pRead = new u8[m_nReadCapacity];
+	}
+	return m_pRead;
+}
+
+void MPSSECommands::Scatter()
+{
+	const u8* ptr = m_pRead;
+	for (u32 n = 0; n < m_nSlices; n++)
+	{
+		if (m_slices[n].pDest)
+		{
+			memcpy(m_slices[n].pDest, ptr, m_slices[n].nSize);
+		}
+		ptr += m_slices[n].nSize;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Pins
+////////////////////////////////////////////////////////////////////////////////
+
+void MPSSECommands::SetPins(u8 nPins, u8 nDirection)
+{
+	u8* ptr = Reserve(3);
+	*ptr++ = SET_BITS_LOW;
+	*ptr++ = nPins;
+	*ptr++ = nDirection;
+}
+
+void MPSSECommands::ChipSelect(bool bSelect)
+{
+	SetPins(bSelect ? (m_nPins & ~m_nSelect) : (m_nPins | m_nSelect), m_nDirection);
+}
+
+void MPSSECommands::GetPins(void* pDest)
+{
+	*Reserve(1) = GET_BITS_LOW;
+	AddSlice(pDest, 1);
+}
+
+void MPSSECommands::ClockBits(u32 nBits)
+{
+	while (nBits)
+	{
+		const u32 bits = nBits < 8 ? nBits : 8;
+		u8* ptr = Reserve(2);
+		*ptr++ = CLK_BITS;
+		*ptr++ = (u8)(bits - 1);
+		nBits -= bits;
+	}
+}
+
+void MPSSECommands::SetClock(const MPSSEClock& clock)
+{
+	u8* ptr = Reserve(4);
+	*ptr++ = clock.bDiv5 ? EN_DIV_5 : DIS_DIV_5;
+	*ptr++ = TCK_DIVISOR;
+	*ptr++ = (u8)clock.nDivisor;
+	*ptr++ = (u8)(clock.nDivisor >> 8);
+}
+
+void MPSSECommands::SendImmediate()
+{
+	*Reserve(1) = SEND_IMMEDIATE;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// SPI data, data out changes on the falling edge
+////////////////////////////////////////////////////////////////////////////////
+
+void MPSSECommands::DataCommand(u8 opcode, const void* pData, u8 nFill, void* pDest, u32 nSize)
+{
+	const u8* src = (const u8*)pData;
+	u8* dst = (u8*)pDest;
+	while (nSize)
+	{
+		const u32 chunk = nSize < MPSSE_MAX_TRANSFER ? nSize : MPSSE_MAX_TRANSFER;
+		const bool bOut = (opcode & MPSSE_DO_WRITE) != 0;
+
+		u8* ptr = Reserve(3 + (bOut ? chunk : 0));
+		*ptr++ = opcode;
+		*ptr++ = (u8)(chunk - 1);
+		*ptr++ = (u8)((chunk - 1) >> 8);
+		if (bOut)
+		{
+			if (src) memcpy(ptr, src, chunk);
+			else memset(ptr, nFill, chunk);
+		}
+
+		if (opcode & MPSSE_DO_READ)
+		{
+			AddSlice(dst, chunk);
+		}
+
+		if (src) src += chunk;
+		if (dst) dst += chunk;
+		nSize -= chunk;
+	}
+}
+
+void MPSSECommands::WriteBytes(const void* pData, u32 nSize)
+{
+	DataCommand(MPSSE_DO_WRITE | MPSSE_WRITE_NEG, pData, 0, 0, nSize);
+}
+
+void MPSSECommands::FillBytes(u8 nValue, u32 nSize)
+{
+	DataCommand(MPSSE_DO_WRITE | MPSSE_WRITE_NEG, 0, nValue, 0, nSize);
+}
+
+// clock in data without driving anything out, so there is no dummy byte sent
+// over USB for every byte read
+void MPSSECommands::ReadBytes(void* pDest, u32 nSize)
+{
+	DataCommand(MPSSE_DO_READ, 0, 0, pDest, nSize);
+}
+
+void MPSSECommands::TransferBytes(const void* pData, void* pDest, u32 nSize)
+{
+	DataCommand(MPSSE_DO_WRITE | MPSSE_WRITE_NEG | MPSSE_DO_READ, pData, 0, pDest, nSize);
+}
+
+void MPSSECommands::FillTransferBytes(u8 nValue, void* pDest, u32 nSize)
+{
+	DataCommand(MPSSE_DO_WRITE | MPSSE_WRITE_NEG | MPSSE_DO_READ, 0, nValue, pDest, nSize);
+}
+
+// clocks with no data in or out (dummy cycles after fast read addresses etc),
+// three bytes of command however many clocks are needed
+void MPSSECommands::DummyBytes(u32 nSize)
+{
+	while (nSize)
+	{
+		const u32 chunk = nSize < MPSSE_MAX_TRANSFER ? nSize : MPSSE_MAX_TRANSFER;
+		u8* ptr = Reserve(3);
+		*ptr++ = CLK_BYTES;
+		*ptr++ = (u8)(chunk - 1);
+		*ptr++ = (u8)((chunk - 1) >> 8);
+		nSize -= chunk;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Whole SPI transactions
+////////////////////////////////////////////////////////////////////////////////
+
+void MPSSECommands::Command(u8 cmd)
+{
+	CommandWithData(cmd, 0, 0, 0);
+}
+
+void MPSSECommands::CommandWithData(u8 cmd, const void* bufOut, void* bufIn, u32 size)
+{
+	ChipSelect(true);
+	WriteBytes(&cmd, 1);
+	Payload(bufOut, bufIn, size);
+	ChipSelect(false);
+}
+
+void MPSSECommands::CommandWithAddrAndData(u8 cmd, u32 addr, const void* bufOut, void* bufIn, u32 size)
+{
+	const u8 header[4] = { cmd, (u8)(addr >> 16), (u8)(addr >> 8), (u8)addr };
+
+	ChipSelect(true);
+	WriteBytes(header, 4);
+	Payload(bufOut, bufIn, size);
+	ChipSelect(false);
+}
+
+void MPSSECommands::Payload(const void* bufOut, void* bufIn, u32 size)
+{
+	if (size == 0)
+	{
+		return;
+	}
+
+	if (bufOut > (const void*)0xff)
+	{
+		if (bufIn) TransferBytes(bufOut, bufIn, size);
+		else WriteBytes(bufOut, size);
+	}
+	else if (bufIn)
+	{
+		if (bufOut) FillTransferBytes((u8)(size_t)bufOut, bufIn, size);
+		else ReadBytes(bufIn, size);
+	}
+	else
+	{
+		FillBytes((u8)(size_t)bufOut, size);
+	}
+}
@@ -0,0 +1,114 @@
+#ifndef _MPSSE_H_
+#define _MPSSE_H_
+
+#include "Types.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// MPSSE command builder
+// Appends commands to an arena that is kept between sequences, so whole SPI
+// sequences (write enable, command, status poll...) are built without any
+// allocation and go out in a single USB write. Reads are recorded as slices
+// of the read back data, and copied to the caller's buffers by Scatter once
+// it has arrived. A slice with no buffer is left for the caller to collect.
+////////////////////////////////////////////////////////////////////////////////
+
+#define MPSSE_ARENA_SIZE				1024		// initial size, grows as needed
+#define MPSSE_MAX_SLICES				16
+#define MPSSE_MAX_TRANSFER				65536		// bytes per MPSSE data command
+
+////////////////////////////////////////////////////////////////////////////////
+// Clock planning
+// TCK is base/((1+divisor)*2), the base being 60Mhz with the divide by 5
+// prescaler off or 12Mhz with it on (the power on default), and the divisor
+// 16 bits. The prescaler is only used for clocks too slow to reach without.
+////////////////////////////////////////////////////////////////////////////////
+
+#define MPSSE_CLOCK_BASE				60000000	// Hz, divide by 5 off
+#define MPSSE_CLOCK_BASE_DIV5			12000000	// Hz, divide by 5 on
+#define MPSSE_CLOCK_MAX					(MPSSE_CLOCK_BASE / 2)
+#define MPSSE_CLOCK_MIN					(MPSSE_CLOCK_BASE_DIV5 / (65536 * 2))
+
+struct MPSSEClock
+{
+	bool bDiv5;
+	u16 nDivisor;
+	u32 nFrequency;								// Hz actually achieved
+};
+
+u32 MPSSEClockFrequency(bool bDiv5, u16 nDivisor);
+MPSSEClock MPSSEPlanClock(u32 nRequested);		// fastest not above nRequested Hz
+bool MPSSEClockSelfTest();						// checks the plan for every rate up to twice the max
+
+struct MPSSESlice
+{
+	void* pDest;
+	u32 nSize;
+};
+
+class MPSSECommands
+{
+public:
+	MPSSECommands();
+	~MPSSECommands();
+
+	// start a new sequence, with the pin states and directions used outside
+	// of transactions and the chip select pin (active low)
+	void Begin(u8 nPins, u8 nDirection, u8 nSelect);
+
+	// pins and raw MPSSE data
+	void SetPins(u8 nPins, u8 nDirection);
+	void ChipSelect(bool bSelect);
+	void GetPins(void* pDest);
+	void ClockBits(u32 nBits);
+	void SetClock(const MPSSEClock& clock);
+	void SendImmediate();
+
+	// SPI data, any length (split into MPSSE_MAX_TRANSFER commands)
+	void WriteBytes(const void* pData, u32 nSize);
+	void FillBytes(u8 nValue, u32 nSize);
+	void ReadBytes(void* pDest, u32 nSize);
+	void TransferBytes(const void* pData, void* pDest, u32 nSize);
+	void FillTransferBytes(u8 nValue, void* pDest, u32 nSize);
+	void DummyBytes(u32 nSize);
+
+	// whole SPI transactions, chip select low to high. bufOut of 0xff or
+	// less sends that value repeated, except that a read with bufOut of 0
+	// clocks the data in without sending anything
+	void Command(u8 cmd);
+	void CommandWithData(u8 cmd, const void* bufOut, void* bufIn, u32 size);
+	void CommandWithAddrAndData(u8 cmd, u32 addr, const void* bufOut, void* bufIn, u32 size);
+
+	// the built sequence
+	const u8* Data() const { return m_pArena; }
+	u32 Size() const { return m_nSize; }
+	u32 ReadSize() const { return m_nReadSize; }
+	bool Ok() const { return !m_bOverflow; }
+
+	// somewhere to read the data back to, then copy it to the slices
+	u8* ReadBuffer();
+	void Scatter();
+
+private:
+	MPSSECommands(const MPSSECommands&) = delete;
+	MPSSECommands& operator=(const MPSSECommands&) = delete;
+
+	u8* Reserve(u32 nBytes);
+	void AddSlice(void* pDest, u32 nSize);
+	void DataCommand(u8 opcode, const void* pData, u8 nFill, void* pDest, u32 nSize);
+	void Payload(const void* bufOut, void* bufIn, u32 size);
+
+	u8* m_pArena;
+	u32 m_nCapacity;
+	u32 m_nSize;
+	u8* m_pRead;
+	u32 m_nReadCapacity;
+	u32 m_nReadSize;
+	MPSSESlice m_slices[MPSSE_MAX_SLICES];
+	u32 m_nSlices;
+	bool m_bOverflow;							// too many slices to map
+	u8 m_nPins;
+	u8 m_nDirection;
+	u8 m_nSelect;
+};
+
+#endif // _MPSSE_H_
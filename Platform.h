@@ -0,0 +1,27 @@
+#ifndef _PLATFORM_H_
+#define _PLATFORM_H_
+
+////////////////////////////////////////////////////////////////////////////////
+// The few Windows runtime calls we use, for building elsewhere
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef _WIN32
+
+#include <stdio.h>
+#include <ctype.h>
+#include <strings.h>
+#include <unistd.h>
+
+#define Sleep(ms)		usleep((ms) * 1000)
+#define _stricmp		strcasecmp
+#define _strnicmp		strncasecmp
+
+inline int fopen_s(FILE** pFile, const char* pFilename, const char* pMode)
+{
+	*pFile = fopen(pFilename, pMode);
+	return *pFile ? 0 : 1;
+}
+
+#endif
+
+#endif // _PLATFORM_H_
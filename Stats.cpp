@@ -0,0 +1,138 @@
+#include <stdio.h>
+#include <string.h>
+#include "Stats.h"
+
+const char* gStatOpNames[STAT_OPS] = { "other", "image", "write page", "poll status", "read", "erase sector", "erase 32K", "erase 64K", "erase chip" };
+const char* gStatIONames[STAT_IOS] = { "usb write", "usb read", "sleep" };
+
+////////////////////////////////////////////////////////////////////////////////
+// Recording
+////////////////////////////////////////////////////////////////////////////////
+
+void StatsReset(SessionStats* pStats)
+{
+	memset(pStats, 0, sizeof(SessionStats));
+	pStats->nCurrent = STAT_OP_OTHER;
+}
+
+void StatsAdd(StatHistogram* pHistogram, u64 us)
+{
+	u32 bucket = 0;
+	for (u64 v = us; v && bucket < STAT_BUCKETS - 1; v >>= 1) bucket++;
+
+	pHistogram->count++;
+	pHistogram->totalUs += us;
+	if (us > pHistogram->maxUs) pHistogram->maxUs = us;
+	pHistogram->buckets[bucket]++;
+}
+
+void StatsIO(SessionStats* pStats, u8 io, u64 bytes, u64 us)
+{
+	StatsIOFor(pStats, pStats->nCurrent, io, bytes, us);
+}
+
+// for I/O completing after the operation that started it
+void StatsIOFor(SessionStats* pStats, u8 op, u8 io, u64 bytes, u64 us)
+{
+	StatIO* p = &pStats->ops[op].io[io];
+	p->bytes += bytes;
+	StatsAdd(&p->latency, us);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Upper bound of the bucket holding the percentile, so a little pessimistic
+////////////////////////////////////////////////////////////////////////////////
+
+u64 StatsPercentile(const StatHistogram* pHistogram, u32 percent)
+{
+	const u64 target = (pHistogram->count * percent + 99) / 100;
+	u64 seen = 0;
+	for (u32 n = 0; n < STAT_BUCKETS; n++)
+	{
+		seen += pHistogram->buckets[n];
+		if (seen >= target && seen)
+		{
+			const u64 bound = n ? (1ull << n) - 1 : 0;
+			return bound < pHistogram->maxUs ? bound : pHistogram->maxUs;
+		}
+	}
+	return pHistogram->maxUs;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Summary, one line per operation used and one per kind of I/O within it
+////////////////////////////////////////////////////////////////////////////////
+
+static void StatsPrintLine(const char* pName, const StatHistogram* h, const char* pIndent)
+{
+	printf("%s%-*s %8llu %10.1fms  avg %7lluus  p50 %7lluus  p99 %7lluus  max %7lluus", pIndent, (int)(16 - strlen(pIndent)), pName,
+		(unsigned long long)h->count, h->totalUs / 1000.0, (unsigned long long)(h->count ? h->totalUs / h->count : 0),
+		(unsigned long long)StatsPercentile(h, 50), (unsigned long long)StatsPercentile(h, 99), (unsigned long long)h->maxUs);
+}
+
+void StatsPrint(const SessionStats* pStats)
+{
+	printf("Statistics:\n");
+	printf("  %-14s %8s %12s\n", "operation", "count", "time");
+	for (u32 op = 0; op < STAT_OPS; op++)
+	{
+		const StatOp* p = &pStats->ops[op];
+		bool bUsed = p->calls.count != 0;
+		for (u32 io = 0; io < STAT_IOS; io++) bUsed |= p->io[io].latency.count != 0;
+		if (!bUsed)
+		{
+			continue;
+		}
+
+		if (p->calls.count) StatsPrintLine(gStatOpNames[op], &p->calls, "  ");
+		else printf("  %s", gStatOpNames[op]);
+		printf("\n");
+		for (u32 io = 0; io < STAT_IOS; io++)
+		{
+			const StatIO* i = &p->io[io];
+			if (!i->latency.count)
+			{
+				continue;
+			}
+
+			StatsPrintLine(gStatIONames[io], &i->latency, "    ");
+			if (io != STAT_IO_SLEEP) printf("  %lluKB", (unsigned long long)(i->bytes + 1023) / 1024);
+			printf("\n");
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// JSON, histograms in full so runs can be compared offline
+////////////////////////////////////////////////////////////////////////////////
+
+static void StatsWriteHistogram(FILE* f, const StatHistogram* h)
+{
+	fprintf(f, "{\"count\": %llu, \"totalUs\": %llu, \"maxUs\": %llu, \"p50Us\": %llu, \"p99Us\": %llu, \"buckets\": [",
+		(unsigned long long)h->count, (unsigned long long)h->totalUs, (unsigned long long)h->maxUs,
+		(unsigned long long)StatsPercentile(h, 50), (unsigned long long)StatsPercentile(h, 99));
+	for (u32 n = 0; n < STAT_BUCKETS; n++)
+	{
+		fprintf(f, "%s%llu", n ? ", " : "", (unsigned long long)h->buckets[n]);
+	}
+	fprintf(f, "]}");
+}
+
+void StatsWriteJSON(const SessionStats* pStats, FILE* f)
+{
+	fprintf(f, "{\n  \"bucketsUs\": \"bucket n holds [2^(n-1), 2^n)\",\n  \"operations\": [");
+	for (u32 op = 0; op < STAT_OPS; op++)
+	{
+		const StatOp* p = &pStats->ops[op];
+		fprintf(f, "%s\n    {\"name\": \"%s\",\n      \"calls\": ", op ? "," : "", gStatOpNames[op]);
+		StatsWriteHistogram(f, &p->calls);
+		for (u32 io = 0; io < STAT_IOS; io++)
+		{
+			fprintf(f, ",\n      \"%s\": {\"bytes\": %llu, \"latency\": ", gStatIONames[io], (unsigned long long)p->io[io].bytes);
+			StatsWriteHistogram(f, &p->io[io].latency);
+			fprintf(f, "}");
+		}
+		fprintf(f, "}");
+	}
+	fprintf(f, "\n  ]\n}\n");
+}
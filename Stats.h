@@ -0,0 +1,72 @@
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include <stdio.h>
+#include "Types.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Session statistics
+// Every USB write, read and sleep is charged to the logical operation that
+// was running at the time (the innermost, so a status poll inside an erase
+// counts as polling). Each operation keeps its call durations and, per kind
+// of I/O, the bytes moved and how long the host was blocked, as log2
+// histograms in microseconds. Image decoding runs on the host, so it is timed
+// on the host clock even on the emulator.
+////////////////////////////////////////////////////////////////////////////////
+
+#define STAT_OP_OTHER				0			// setup, identify, status...
+#define STAT_OP_IMAGE				1			// loading and decoding image files
+#define STAT_OP_WRITE_PAGE			2
+#define STAT_OP_POLL_STATUS			3
+#define STAT_OP_READ				4
+#define STAT_OP_ERASE_SECTOR		5
+#define STAT_OP_ERASE_32K			6
+#define STAT_OP_ERASE_64K			7
+#define STAT_OP_ERASE_CHIP			8
+#define STAT_OPS					9
+
+#define STAT_IO_WRITE				0
+#define STAT_IO_READ				1
+#define STAT_IO_SLEEP				2
+#define STAT_IOS					3
+
+#define STAT_BUCKETS				24			// bucket n holds [2^(n-1), 2^n)us, the last anything longer
+
+extern const char* gStatOpNames[STAT_OPS];
+extern const char* gStatIONames[STAT_IOS];
+
+struct StatHistogram
+{
+	u64 count;
+	u64 totalUs;
+	u64 maxUs;
+	u64 buckets[STAT_BUCKETS];
+};
+
+struct StatIO
+{
+	StatHistogram latency;
+	u64 bytes;
+};
+
+struct StatOp
+{
+	StatHistogram calls;
+	StatIO io[STAT_IOS];
+};
+
+struct SessionStats
+{
+	StatOp ops[STAT_OPS];
+	u8 nCurrent;								// operation running now
+};
+
+void StatsReset(SessionStats* pStats);
+void StatsAdd(StatHistogram* pHistogram, u64 us);
+void StatsIO(SessionStats* pStats, u8 io, u64 bytes, u64 us);
+void StatsIOFor(SessionStats* pStats, u8 op, u8 io, u64 bytes, u64 us);
+u64 StatsPercentile(const StatHistogram* pHistogram, u32 percent);
+void StatsPrint(const SessionStats* pStats);
+void StatsWriteJSON(const SessionStats* pStats, FILE* f);
+
+#endif // _STATS_H_
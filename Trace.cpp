@@ -0,0 +1,769 @@
+#include <stdio.h>
+#include <string.h>
+#include "Platform.h"
+#include "ConfigSession.h"
+#include "Stats.h"
+#include "Trace.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Capture
+// Requests are wrapped so reads can be recorded once their data has arrived.
+////////////////////////////////////////////////////////////////////////////////
+
+struct CaptureRequest
+{
+	TransportRequest* pInner;
+	u8* pRead;									// destination of a read, 0 for writes
+	u32 nSize;
+	u64 submitted;
+};
+
+CaptureTransport::CaptureTransport(Transport* pInner, const char* pFilename)
+	: m_pInner(pInner)
+	, m_pFilename(pFilename)
+	, m_pFile(0)
+	, m_last(0)
+{
+}
+
+CaptureTransport::~CaptureTransport()
+{
+	if (m_pFile)
+	{
+		fclose(m_pFile);
+	}
+	delete m_pInner;
+}
+
+bool CaptureTransport::Open(const AdapterInfo* pAdapter)
+{
+	if (fopen_s(&m_pFile, m_pFilename, "wb") != 0)
+	{
+		fprintf(stderr, "Unable to write trace file %s.\n", m_pFilename);
+		m_pFile = 0;
+		return false;
+	}
+	fwrite(TRACE_MAGIC, 1, 4, m_pFile);
+	fputc(TRACE_VERSION, m_pFile);
+	m_last = m_pInner->Now();
+
+	if (!m_pInner->Open(pAdapter))
+	{
+		return false;
+	}
+
+	char serial[64];
+	char note[TRACE_MAX_NOTE];
+	const u32 len = snprintf(note, sizeof(note), "serial %s", m_pInner->GetSerial(serial, sizeof(serial)) && serial[0] ? serial : "-");
+	Record(TRACE_RECORD_NOTE);
+	Varint(len);
+	fwrite(note, 1, len, m_pFile);
+	return true;
+}
+
+void CaptureTransport::Close()
+{
+	m_pInner->Close();
+	if (m_pFile)
+	{
+		fclose(m_pFile);
+		m_pFile = 0;
+	}
+}
+
+bool CaptureTransport::Configure(const TransportProfile& profile)
+{
+	if (m_pFile)
+	{
+		char note[TRACE_MAX_NOTE];
+		const u32 len = snprintf(note, sizeof(note), "latency %dms, chunks %d read %d write", profile.latencyMs, profile.readChunk, profile.writeChunk);
+		Record(TRACE_RECORD_NOTE);
+		Varint(len);
+		fwrite(note, 1, len, m_pFile);
+	}
+	return m_pInner->Configure(profile);
+}
+
+bool CaptureTransport::GetSerial(char* pSerial, u32 nSize)
+{
+	return m_pInner->GetSerial(pSerial, nSize);
+}
+
+TransportRequest* CaptureTransport::WriteSubmit(const void* pData, u32 nSize)
+{
+	if (m_pFile)
+	{
+		Record(TRACE_RECORD_WRITE);
+		Varint(nSize);
+		Data((const u8*)pData, nSize);
+	}
+
+	TransportRequest* pInner = m_pInner->WriteSubmit(pData, nSize);
+	if (!pInner)
+	{
+		return 0;
+	}
+
+	CaptureRequest* r = new CaptureRequest;
+	r->pInner = pInner;
+	r->pRead = 0;
+	r->nSize = nSize;
+	r->submitted = m_last;
+	return (TransportRequest*)r;
+}
+
+TransportRequest* CaptureTransport::ReadSubmit(void* pData, u32 nSize)
+{
+	TransportRequest* pInner = m_pInner->ReadSubmit(pData, nSize);
+	if (!pInner)
+	{
+		return 0;
+	}
+
+	CaptureRequest* r = new CaptureRequest;
+	r->pInner = pInner;
+	r->pRead = (u8*)pData;
+	r->nSize = nSize;
+	r->submitted = m_pInner->Now();
+	return (TransportRequest*)r;
+}
+
+s32 CaptureTransport::Wait(TransportRequest* pRequest)
+{
+	CaptureRequest* r = (CaptureRequest*)pRequest;
+	const s32 ret = m_pInner->Wait(r->pInner);
+
+	if (r->pRead && m_pFile)
+	{
+		const u32 got = ret > 0 ? (u32)ret : 0;
+		Record(TRACE_RECORD_READ);
+		Varint(m_last > r->submitted ? m_last - r->submitted : 0);
+		Varint(r->nSize);
+		Varint(got);
+		Data(r->pRead, got);
+	}
+
+	delete r;
+	return ret;
+}
+
+u64 CaptureTransport::Now()
+{
+	return m_pInner->Now();
+}
+
+void CaptureTransport::Delay(u32 ms)
+{
+	if (m_pFile)
+	{
+		Record(TRACE_RECORD_DELAY);
+		Varint(ms);
+	}
+	m_pInner->Delay(ms);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Record encoding
+////////////////////////////////////////////////////////////////////////////////
+
+void CaptureTransport::Record(u8 type)
+{
+	const u64 now = m_pInner->Now();
+	fputc(type, m_pFile);
+	Varint(now > m_last ? now - m_last : 0);
+	if (now > m_last) m_last = now;
+}
+
+void CaptureTransport::Varint(u64 v)
+{
+	while (v >= 0x80)
+	{
+		fputc((u8)(v | 0x80), m_pFile);
+		v >>= 7;
+	}
+	fputc((u8)v, m_pFile);
+}
+
+// pieces are a varint of length << 1, with bit 0 set for a run of the one
+// byte that follows, clear for that many literal bytes
+void CaptureTransport::Data(const u8* pData, u32 nSize)
+{
+	u32 n = 0;
+	while (n < nSize)
+	{
+		u32 run = 1;
+		while (n + run < nSize && pData[n + run] == pData[n]) run++;
+		if (run >= TRACE_MIN_RUN)
+		{
+			Varint(((u64)run << 1) | 1);
+			fputc(pData[n], m_pFile);
+			n += run;
+			continue;
+		}
+
+		// literals up to the next run worth coding
+		u32 end = n + run;
+		while (end < nSize)
+		{
+			u32 next = 1;
+			while (end + next < nSize && next < TRACE_MIN_RUN && pData[end + next] == pData[end]) next++;
+			if (next >= TRACE_MIN_RUN) break;
+			end += next;
+		}
+		Varint((u64)(end - n) << 1);
+		fwrite(pData + n, 1, end - n, m_pFile);
+		n = end;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Analysis
+// The write stream is run through an MPSSE interpreter that tracks SS# and
+// the clock, so each chip select window becomes a transaction. Times are
+// estimates: the MPSSE is taken to start on each buffer when it is
+// submitted (or when it finishes the previous one) and to clock at the
+// programmed rate, USB transfer time is not known.
+////////////////////////////////////////////////////////////////////////////////
+
+struct TraceOpInfo
+{
+	u8 cmd;
+	const char* pName;
+	u8 nAddress;								// bytes after the command
+	u8 nDummy;
+	bool bDual;
+};
+
+static const TraceOpInfo gTraceOps[] =
+{
+	{ CMD_WRITE_ENABLE,				"write enable",		0, 0, false },
+	{ CMD_WRITE_DISABLE,			"write disable",	0, 0, false },
+	{ CMD_READ_STATUS_REGISTER1,	"read status 1",	0, 0, false },
+	{ CMD_READ_STATUS_REGISTER2,	"read status 2",	0, 0, false },
+	{ CMD_WRITE_STATUS_REGISTERS,	"write status",		0, 0, false },
+	{ CMD_READ_DEVICE_ID,			"read device id",	3, 0, false },
+	{ CMD_READ_UNIQUE_ID,			"read unique id",	0, 4, false },
+	{ CMD_READ_JEDEC_ID,			"read jedec id",	0, 0, false },
+	{ CMD_SECTOR_ERASE,				"sector erase",		3, 0, false },
+	{ CMD_BLOCK_ERASE_32K,			"block erase 32K",	3, 0, false },
+	{ CMD_BLOCK_ERASE_64K,			"block erase 64K",	3, 0, false },
+	{ CMD_CHIP_ERASE,				"chip erase",		0, 0, false },
+	{ CMD_CHIP_ERASE_ALT,			"chip erase",		0, 0, false },
+	{ CMD_PROGRAM_PAGE,				"program page",		3, 0, false },
+	{ CMD_READ_BYTES,				"read",				3, 0, false },
+	{ CMD_FAST_READ,				"fast read",		3, 1, false },
+	{ CMD_DUAL_OUTPUT_READ,			"dual read",		3, 1, true },
+	{ CMD_WAKE_UP,					"wake up",			0, 3, false },
+	{ CMD_POWER_DOWN,				"power down",		0, 0, false },
+	{ CMD_RESET_ENABLE,				"reset enable",		0, 0, false },
+	{ CMD_RESET,					"reset",			0, 0, false },
+};
+
+#define TRACE_OPS					(COUNTOF(gTraceOps) + 1)	// and unknown
+#define TRACE_OP_UNKNOWN			COUNTOF(gTraceOps)
+
+struct TraceOpTotals
+{
+	u64 count;
+	u64 bytes;
+	double selectedUs;
+	StatHistogram gapBefore;
+};
+
+struct TraceSequence
+{
+	u64 count;
+	double totalUs;
+	double maxUs;
+};
+
+struct TraceGap
+{
+	double gapUs;
+	double at;
+	u32 prevOp;
+	u32 op;
+};
+
+struct TraceDecoder
+{
+	bool bList;
+
+	// MPSSE
+	u8 nPins;
+	u8 nDirection;
+	bool bDiv5;
+	u16 nDivisor;
+	double clockUs;
+	double t;									// estimated, from the first record
+
+	// transaction under way
+	bool bSelected;
+	double start;
+	u8 header[4];
+	u32 nHeader;
+	u64 nClocks;
+
+	// and the one before
+	bool bPrevious;
+	u32 prevOp;
+	double prevEnd;
+
+	u64 nTransactions;
+	u64 nBadCommands;
+	TraceOpTotals ops[TRACE_OPS];
+	TraceSequence sequences[TRACE_OPS][TRACE_OPS];
+	TraceGap gaps[TRACE_TOP_GAPS];
+	StatHistogram allGaps;
+};
+
+static const char* TraceOpName(u32 op)
+{
+	return op < TRACE_OP_UNKNOWN ? gTraceOps[op].pName : "unknown";
+}
+
+static void TraceSetClock(TraceDecoder* d)
+{
+	d->clockUs = 1000000.0 / MPSSEClockFrequency(d->bDiv5, d->nDivisor);
+}
+
+static bool TraceSelected(const TraceDecoder* d)
+{
+	// an undriven SS# is pulled up
+	return (d->nDirection & CA_SS_N) && !(d->nPins & CA_SS_N);
+}
+
+static void TraceEnd(TraceDecoder* d)
+{
+	if (!d->nClocks)
+	{
+		return;
+	}
+
+	u32 op = TRACE_OP_UNKNOWN;
+	for (u32 n = 0; d->nHeader && n < TRACE_OP_UNKNOWN; n++)
+	{
+		if (gTraceOps[n].cmd == d->header[0]) op = n;
+	}
+
+	// data length is what was clocked after the command, address and dummy
+	// bytes, dual reads moving two bits a clock
+	const TraceOpInfo* info = op < TRACE_OP_UNKNOWN ? &gTraceOps[op] : 0;
+	const u64 headerClocks = info ? 8 * (1 + info->nAddress + info->nDummy) : 8;
+	const u64 bytes = d->nClocks > headerClocks ? (d->nClocks - headerClocks) / (info && info->bDual ? 4 : 8) : 0;
+	const double selected = d->t - d->start;
+	const double gap = d->bPrevious ? d->start - d->prevEnd : 0;
+
+	TraceOpTotals* totals = &d->ops[op];
+	totals->count++;
+	totals->bytes += bytes;
+	totals->selectedUs += selected;
+	d->nTransactions++;
+
+	if (d->bPrevious)
+	{
+		StatsAdd(&totals->gapBefore, (u64)gap);
+		StatsAdd(&d->allGaps, (u64)gap);
+
+		TraceSequence* s = &d->sequences[d->prevOp][op];
+		s->count++;
+		s->totalUs += gap;
+		if (gap > s->maxUs) s->maxUs = gap;
+
+		// keep the largest few, sorted
+		for (u32 n = 0; n < TRACE_TOP_GAPS; n++)
+		{
+			if (gap > d->gaps[n].gapUs)
+			{
+				memmove(&d->gaps[n + 1], &d->gaps[n], (TRACE_TOP_GAPS - n - 1) * sizeof(TraceGap));
+				d->gaps[n].gapUs = gap;
+				d->gaps[n].at = d->start;
+				d->gaps[n].prevOp = d->prevOp;
+				d->gaps[n].op = op;
+				break;
+			}
+		}
+	}
+
+	if (d->bList)
+	{
+		printf("  %12.3fms  %10.1fus  %-16s", d->start / 1000.0, gap, TraceOpName(op));
+		if (info && info->nAddress == 3 && d->nHeader >= 4) printf("  $%06x", (d->header[1] << 16) | (d->header[2] << 8) | d->header[3]);
+		else if (!info && d->nHeader) printf("  ($%02x) ", d->header[0]);
+		else printf("         ");
+		printf("  %6llu bytes  %8.1fus\n", (unsigned long long)bytes, selected);
+	}
+
+	d->bPrevious = true;
+	d->prevOp = op;
+	d->prevEnd = d->t;
+}
+
+static void TraceSetPins(TraceDecoder* d, u8 nPins, u8 nDirection)
+{
+	const bool bWas = TraceSelected(d);
+	d->nPins = nPins;
+	d->nDirection = nDirection;
+	const bool bNow = TraceSelected(d);
+
+	if (!bWas && bNow)
+	{
+		d->bSelected = true;
+		d->start = d->t;
+		d->nHeader = 0;
+		d->nClocks = 0;
+	}
+	else if (bWas && !bNow)
+	{
+		d->bSelected = false;
+		TraceEnd(d);
+	}
+}
+
+static void TraceClock(TraceDecoder* d, u64 nClocks, const u8* pOut, u32 nOut)
+{
+	d->t += nClocks * d->clockUs;
+	if (d->bSelected)
+	{
+		d->nClocks += nClocks;
+		while (pOut && nOut-- && d->nHeader < sizeof(d->header))
+		{
+			d->header[d->nHeader++] = *pOut++;
+		}
+	}
+}
+
+// returns the bytes used, 0 if the command isn't all there yet, as the
+// emulator does
+static u32 TraceCommand(TraceDecoder* d, const u8* pCmd, u32 nLeft)
+{
+	const u8 op = pCmd[0];
+	switch (op)
+	{
+		case SET_BITS_LOW:
+			if (nLeft < 3) return 0;
+			TraceSetPins(d, pCmd[1], pCmd[2]);
+			return 3;
+
+		case SET_BITS_HIGH:
+		case CLK_BYTES_OR_HIGH:
+			return nLeft < 3 ? 0 : 3;
+
+		case GET_BITS_LOW:
+		case GET_BITS_HIGH:
+		case SEND_IMMEDIATE:
+		case WAIT_ON_HIGH:
+		case WAIT_ON_LOW:
+		case CLK_WAIT_HIGH:
+		case CLK_WAIT_LOW:
+		case LOOPBACK_START:
+		case LOOPBACK_END:
+		case EN_3_PHASE:
+		case DIS_3_PHASE:
+		case EN_ADAPTIVE:
+		case DIS_ADAPTIVE:
+			return 1;
+
+		case TCK_DIVISOR:
+			if (nLeft < 3) return 0;
+			d->nDivisor = (u16)(pCmd[1] | (pCmd[2] << 8));
+			TraceSetClock(d);
+			return 3;
+
+		case DIS_DIV_5:
+		case EN_DIV_5:
+			d->bDiv5 = op == EN_DIV_5;
+			TraceSetClock(d);
+			return 1;
+
+		case CLK_BITS:
+			if (nLeft < 2) return 0;
+			TraceClock(d, pCmd[1] + 1, 0, 0);
+			return 2;
+
+		case CLK_BYTES:
+		case CLK_BYTES_OR_LOW:
+			if (nLeft < 3) return 0;
+			TraceClock(d, (u64)((pCmd[1] | (pCmd[2] << 8)) + 1) * 8, 0, 0);
+			return 3;
+	}
+
+	// data shifting
+	const bool bWrite = (op & MPSSE_DO_WRITE) != 0;
+	const bool bRead = (op & MPSSE_DO_READ) != 0;
+	if (op < 0x80 && (op & MPSSE_WRITE_TMS))
+	{
+		if (nLeft < 3) return 0;
+		TraceClock(d, (pCmd[1] & 7) + 1, 0, 0);
+		return 3;
+	}
+	else if (op < 0x80 && (op & MPSSE_BITMODE) && (bWrite || bRead))
+	{
+		const u32 len = bWrite ? 3 : 2;
+		if (nLeft < len) return 0;
+		TraceClock(d, (pCmd[1] & 7) + 1, 0, 0);
+		return len;
+	}
+	else if (op < 0x80 && (bWrite || bRead))
+	{
+		if (nLeft < 3) return 0;
+		const u32 count = (pCmd[1] | (pCmd[2] << 8)) + 1;
+		const u32 len = 3 + (bWrite ? count : 0);
+		if (nLeft < len) return 0;
+		TraceClock(d, (u64)count * 8, bWrite ? pCmd + 3 : 0, count);
+		return len;
+	}
+
+	d->nBadCommands++;
+	return 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Reading the file
+////////////////////////////////////////////////////////////////////////////////
+
+static bool TraceVarint(FILE* f, u64* pValue)
+{
+	u64 v = 0;
+	for (u32 shift = 0; shift < 64; shift += 7)
+	{
+		const int c = fgetc(f);
+		if (c == EOF)
+		{
+			return false;
+		}
+		v |= (u64)(c & 0x7f) << shift;
+		if (!(c & 0x80))
+		{
+			*pValue = v;
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool TraceData(FILE* f, u8* pOut, u32 nSize)
+{
+	u32 n = 0;
+	while (n < nSize)
+	{
+		u64 piece;
+		if (!TraceVarint(f, &piece) || (piece >> 1) > nSize - n || (piece >> 1) == 0)
+		{
+			return false;
+		}
+
+		const u32 len = (u32)(piece >> 1);
+		if (piece & 1)
+		{
+			const int c = fgetc(f);
+			if (c == EOF) return false;
+			memset(pOut + n, c, len);
+		}
+		else if (fread(pOut + n, 1, len, f) != len)
+		{
+			return false;
+		}
+		n += len;
+	}
+	return true;
+}
+
+static void TraceTop(const TraceDecoder* d)
+{
+	printf("Slowest sequences (time between transactions, estimated):\n");
+	bool used[TRACE_OPS][TRACE_OPS];
+	memset(used, 0, sizeof(used));
+	for (u32 rank = 0; rank < TRACE_TOP_SEQUENCES; rank++)
+	{
+		u32 bestA = 0, bestB = 0;
+		double best = -1;
+		for (u32 a = 0; a < TRACE_OPS; a++)
+		{
+			for (u32 b = 0; b < TRACE_OPS; b++)
+			{
+				const TraceSequence* s = &d->sequences[a][b];
+				if (s->count && !used[a][b] && s->totalUs > best)
+				{
+					best = s->totalUs;
+					bestA = a;
+					bestB = b;
+				}
+			}
+		}
+		if (best < 0)
+		{
+			break;
+		}
+
+		used[bestA][bestB] = true;
+		const TraceSequence* s = &d->sequences[bestA][bestB];
+		printf("  %-16s -> %-16s %8llu  %10.1fms  avg %8.1fus  max %8.1fus\n", TraceOpName(bestA), TraceOpName(bestB),
+			(unsigned long long)s->count, s->totalUs / 1000.0, s->totalUs / s->count, s->maxUs);
+	}
+
+	printf("Largest gaps:\n");
+	for (u32 n = 0; n < TRACE_TOP_GAPS && d->gaps[n].gapUs > 0; n++)
+	{
+		const TraceGap* g = &d->gaps[n];
+		printf("  at %12.3fms  %-16s -> %-16s %10.1fus\n", g->at / 1000.0, TraceOpName(g->prevOp), TraceOpName(g->op), g->gapUs);
+	}
+}
+
+bool TraceAnalyse(const char* pFilename, bool bList)
+{
+	FILE* f;
+	char magic[5] = { 0 };
+	if (fopen_s(&f, pFilename, "rb") != 0)
+	{
+		printf("Unable to read %s.\n", pFilename);
+		return false;
+	}
+	if (fread(magic, 1, 4, f) != 4 || strcmp(magic, TRACE_MAGIC) != 0 || fgetc(f) != TRACE_VERSION)
+	{
+		printf("Trace file corrupt (%s).\n", pFilename);
+		fclose(f);
+		return false;
+	}
+
+	TraceDecoder* d = new TraceDecoder;
+	memset(d, 0, sizeof(TraceDecoder));
+	d->bList = bList;
+	d->nPins = CA_SS_N | CA_CRESET_N;
+	d->bDiv5 = true;							// power on default
+	TraceSetClock(d);
+
+	u64 now = 0;
+	u64 nWrites = 0, nWriteBytes = 0, nReads = 0, nReadBytes = 0, nDelays = 0, nDelayMs = 0;
+	StatHistogram readWaits;
+	StatHistogram usbGaps;
+	memset(&readWaits, 0, sizeof(readWaits));
+	memset(&usbGaps, 0, sizeof(usbGaps));
+
+	// writes are interpreted as they arrive, commands can span buffers
+	u32 nPendingSize = 65536;
+	u32 nPending = 0;
+	u8* pPending = new u8[nPendingSize];
+	u8* pScratch = 0;
+	u32 nScratchSize = 0;
+
+	printf("Trace %s\n", pFilename);
+	if (bList) printf("  %14s  %12s  %-16s  %7s  %12s  %10s\n", "start", "gap", "command", "address", "length", "selected");
+
+	bool bOk = true;
+	int type;
+	while (bOk && (type = fgetc(f)) != EOF)
+	{
+		u64 dt, a, b, c;
+		if (!TraceVarint(f, &dt))
+		{
+			bOk = false;
+			break;
+		}
+		now += dt;
+
+		switch (type)
+		{
+			case TRACE_RECORD_WRITE:
+				if (!(bOk = TraceVarint(f, &a) && a <= READ_MAX_SIZE)) break;
+				if (nPending + a > nPendingSize)
+				{
+					while (nPending + a > nPendingSize) nPendingSize *= 2;
+					u8* p = new u8[nPendingSize];
+					memcpy(p, pPending, nPending);
+					delete[] pPending;
+					pPending = p;
+				}
+				if (!(bOk = TraceData(f, pPending + nPending, (u32)a))) break;
+				nPending += (u32)a;
+				nWrites++;
+				nWriteBytes += a;
+				StatsAdd(&usbGaps, dt);
+
+				// the MPSSE gets to this buffer once it has arrived and the
+				// previous ones are done
+				if ((double)now > d->t) d->t = (double)now;
+				{
+					u32 pos = 0;
+					u32 used;
+					while (pos < nPending && (used = TraceCommand(d, pPending + pos, nPending - pos)) != 0)
+					{
+						pos += used;
+					}
+					memmove(pPending, pPending + pos, nPending - pos);
+					nPending -= pos;
+				}
+				break;
+
+			case TRACE_RECORD_READ:
+				if (!(bOk = TraceVarint(f, &a) && TraceVarint(f, &b) && TraceVarint(f, &c) && c <= b && c <= READ_MAX_SIZE)) break;
+				if (c > nScratchSize)
+				{
+					delete[] pScratch;
+					nScratchSize = (u32)c;
+					pScratch = new u8[nScratchSize];
+				}
+				if (!(bOk = TraceData(f, pScratch, (u32)c))) break;
+				nReads++;
+				nReadBytes += c;
+				StatsAdd(&readWaits, a);
+				StatsAdd(&usbGaps, dt);
+				break;
+
+			case TRACE_RECORD_DELAY:
+				if (!(bOk = TraceVarint(f, &a))) break;
+				nDelays++;
+				nDelayMs += a;
+				break;
+
+			case TRACE_RECORD_NOTE:
+			{
+				char note[TRACE_MAX_NOTE];
+				if (!(bOk = TraceVarint(f, &a) && a < sizeof(note) && fread(note, 1, (size_t)a, f) == a)) break;
+				note[a] = 0;
+				printf("  %12.3fms  %s\n", now / 1000.0, note);
+				break;
+			}
+
+			default:
+				bOk = false;
+				break;
+		}
+	}
+	fclose(f);
+
+	if (!bOk)
+	{
+		printf("Trace file corrupt (%s), reporting what was read.\n", pFilename);
+	}
+
+	printf("USB: %llu writes (%lluKB), %llu reads (%lluKB, waited p50 %lluus p99 %lluus max %lluus), %llu sleeps (%llums)\n",
+		(unsigned long long)nWrites, (unsigned long long)(nWriteBytes + 1023) / 1024,
+		(unsigned long long)nReads, (unsigned long long)(nReadBytes + 1023) / 1024,
+		(unsigned long long)StatsPercentile(&readWaits, 50), (unsigned long long)StatsPercentile(&readWaits, 99), (unsigned long long)readWaits.maxUs,
+		(unsigned long long)nDelays, (unsigned long long)nDelayMs);
+	printf("     between transfers p50 %lluus p99 %lluus max %lluus, %.3fs in all\n",
+		(unsigned long long)StatsPercentile(&usbGaps, 50), (unsigned long long)StatsPercentile(&usbGaps, 99), (unsigned long long)usbGaps.maxUs, now / 1000000.0);
+	printf("SPI: %llu transactions, between them p50 %lluus p99 %lluus max %lluus", (unsigned long long)d->nTransactions,
+		(unsigned long long)StatsPercentile(&d->allGaps, 50), (unsigned long long)StatsPercentile(&d->allGaps, 99), (unsigned long long)d->allGaps.maxUs);
+	if (d->nBadCommands) printf(", %llu bad MPSSE commands", (unsigned long long)d->nBadCommands);
+	printf("\n");
+
+	printf("  %-16s %8s %10s %12s %14s\n", "command", "count", "bytes", "selected", "avg gap before");
+	for (u32 op = 0; op < TRACE_OPS; op++)
+	{
+		const TraceOpTotals* t = &d->ops[op];
+		if (!t->count)
+		{
+			continue;
+		}
+		printf("  %-16s %8llu %10llu %10.1fms %12.1fus\n", TraceOpName(op), (unsigned long long)t->count, (unsigned long long)t->bytes,
+			t->selectedUs / 1000.0, t->gapBefore.count ? (double)t->gapBefore.totalUs / t->gapBefore.count : 0.0);
+	}
+	TraceTop(d);
+
+	delete[] pScratch;
+	delete[] pPending;
+	delete d;
+	return bOk;
+}
@@ -0,0 +1,71 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <stdio.h>
+#include "Types.h"
+#include "Transport.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// MPSSE traces
+// A capture wraps the session's transport and records every buffer written
+// and read back, with its time, so a run can be examined away from the board.
+// The file is a header followed by records, each a type byte, the time since
+// the previous record as a varint (us, session clock), then the type's
+// fields. Buffers are run length coded, status polls and fill data being
+// mostly repeats.
+//
+//   TRACE_RECORD_WRITE		size, data							at submit
+//   TRACE_RECORD_READ		us since submit, size, got, data	at completion
+//   TRACE_RECORD_DELAY		ms									at start
+//   TRACE_RECORD_NOTE		length, text
+////////////////////////////////////////////////////////////////////////////////
+
+#define TRACE_MAGIC					"TFTR"
+#define TRACE_VERSION				1
+
+#define TRACE_RECORD_WRITE			1
+#define TRACE_RECORD_READ			2
+#define TRACE_RECORD_DELAY			3
+#define TRACE_RECORD_NOTE			4
+
+#define TRACE_MIN_RUN				4			// repeats coded as a run from this long
+#define TRACE_MAX_NOTE				256
+
+#define TRACE_TOP_SEQUENCES			10			// reported by TraceAnalyse
+#define TRACE_TOP_GAPS				5
+
+class CaptureTransport : public Transport
+{
+public:
+	CaptureTransport(Transport* pInner, const char* pFilename);	// takes pInner
+	~CaptureTransport();
+
+	bool Open(const AdapterInfo* pAdapter);
+	void Close();
+	bool Configure(const TransportProfile& profile);
+	bool GetSerial(char* pSerial, u32 nSize);
+	TransportRequest* WriteSubmit(const void* pData, u32 nSize);
+	TransportRequest* ReadSubmit(void* pData, u32 nSize);
+	s32 Wait(TransportRequest* pRequest);
+	u64 Now();
+	void Delay(u32 ms);
+
+private:
+	CaptureTransport(const CaptureTransport&) = delete;
+	CaptureTransport& operator=(const CaptureTransport&) = delete;
+
+	void Record(u8 type);
+	void Varint(u64 v);
+	void Data(const u8* pData, u32 nSize);
+
+	Transport* m_pInner;
+	const char* m_pFilename;
+	FILE* m_pFile;
+	u64 m_last;									// time of the previous record
+};
+
+// decode a trace into SPI transactions and report where the time between them
+// goes, bList prints every transaction as well
+bool TraceAnalyse(const char* pFilename, bool bList);
+
+#endif // _TRACE_H_
@@ -0,0 +1,165 @@
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include "Platform.h"
+#include "ftdi.h"
+#include "libusb.h"
+#include "Transport.h"
+#include "Emulator.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Microsecond timer
+////////////////////////////////////////////////////////////////////////////////
+
+u64 TimeMicroseconds()
+{
+	return (u64)std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Transports
+////////////////////////////////////////////////////////////////////////////////
+
+const char* gBackendNames[BACKENDS] = { "ftdi", "emulator" };
+
+// the default 16ms latency timer holds back short reads, so go as low as we can
+const TransportProfile gDefaultTransport = { 1, 65536, 65536 };
+
+void Transport::Delay(u32 ms)
+{
+	Sleep(ms);
+}
+
+Transport* TransportCreate(u8 nBackend, const char* pOption)
+{
+	switch (nBackend)
+	{
+		case BACKEND_FTDI:		return new FTDITransport();
+		case BACKEND_EMULATOR:	return new EmulatorTransport(pOption);
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// libftdi
+// Requests are libftdi's own transfer controls.
+////////////////////////////////////////////////////////////////////////////////
+
+FTDITransport::FTDITransport()
+	: m_pFTDI(0)
+{
+}
+
+FTDITransport::~FTDITransport()
+{
+	Close();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Find all attached adapters
+////////////////////////////////////////////////////////////////////////////////
+
+u32 FTDITransport::FindAdapters(AdapterInfo* pList, u32 nMax)
+{
+	ftdi_context* ftdi = ftdi_new();
+	if (!ftdi)
+	{
+		return 0;
+	}
+
+	u32 count = 0;
+	ftdi_device_list* devlist = 0;
+	if (ftdi_usb_find_all(ftdi, &devlist, 0x0403, FTDI_DEVICE) > 0)
+	{
+		for (ftdi_device_list* dev = devlist; dev && count < nMax; dev = dev->next)
+		{
+			AdapterInfo* a = &pList[count++];
+			a->bus = libusb_get_bus_number(dev->dev);
+			a->address = libusb_get_device_address(dev->dev);
+			a->serial[0] = 0;
+			a->description[0] = 0;
+			ftdi_usb_get_strings(ftdi, dev->dev, 0, 0, a->description, sizeof(a->description), a->serial, sizeof(a->serial));
+		}
+		ftdi_list_free(&devlist);
+	}
+
+	ftdi_free(ftdi);
+	return count;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool FTDITransport::Open(const AdapterInfo* pAdapter)
+{
+	s32 ret;
+
+	// initialise FTDI lib
+	if ((m_pFTDI = ftdi_new()) == 0)
+	{
+		fprintf(stderr, "Unable to initialise libFTDI.\n");
+		return false;
+	}
+
+	// set for interface A (config eeprom SPI) and open, either the given
+	// adapter or the first we find
+	ftdi_set_interface(m_pFTDI, INTERFACE_A);
+	if (pAdapter) ret = ftdi_usb_open_bus_addr(m_pFTDI, pAdapter->bus, pAdapter->address);
+	else ret = ftdi_usb_open(m_pFTDI, 0x0403, FTDI_DEVICE);
+	if (ret < 0)
+	{
+		fprintf(stderr, "Unable to open FTDI device: %d (%s)\n", ret, ftdi_get_error_string(m_pFTDI));
+		ftdi_free(m_pFTDI);
+		m_pFTDI = 0;
+		return false;
+	}
+
+	// initialise MPSSE mode
+	ftdi_usb_reset(m_pFTDI);
+	ftdi_set_bitmode(m_pFTDI, 0, BITMODE_RESET);
+	ftdi_set_bitmode(m_pFTDI, 0, BITMODE_MPSSE);
+
+	Sleep(50); // sleep 50 ms for setup to complete
+	return true;
+}
+
+void FTDITransport::Close()
+{
+	if (m_pFTDI)
+	{
+		ftdi_usb_close(m_pFTDI);
+		ftdi_free(m_pFTDI);
+		m_pFTDI = 0;
+	}
+}
+
+bool FTDITransport::Configure(const TransportProfile& profile)
+{
+	return	m_pFTDI &&
+			ftdi_set_latency_timer(m_pFTDI, profile.latencyMs) == 0 &&
+			ftdi_read_data_set_chunksize(m_pFTDI, profile.readChunk) == 0 &&
+			ftdi_write_data_set_chunksize(m_pFTDI, profile.writeChunk) == 0;
+}
+
+bool FTDITransport::GetSerial(char* pSerial, u32 nSize)
+{
+	return	m_pFTDI &&
+			ftdi_usb_get_strings2(m_pFTDI, libusb_get_device(m_pFTDI->usb_dev), 0, 0, 0, 0, pSerial, nSize) >= 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+TransportRequest* FTDITransport::WriteSubmit(const void* pData, u32 nSize)
+{
+	return (TransportRequest*)ftdi_write_data_submit(m_pFTDI, (unsigned char*)pData, nSize);
+}
+
+TransportRequest* FTDITransport::ReadSubmit(void* pData, u32 nSize)
+{
+	return (TransportRequest*)ftdi_read_data_submit(m_pFTDI, (unsigned char*)pData, nSize);
+}
+
+s32 FTDITransport::Wait(TransportRequest* pRequest)
+{
+	return ftdi_transfer_data_done((ftdi_transfer_control*)pRequest);
+}
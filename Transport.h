@@ -0,0 +1,100 @@
+#ifndef _TRANSPORT_H_
+#define _TRANSPORT_H_
+
+#include "Types.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Transport
+// Carries the MPSSE command stream to an adapter and the read data back.
+// Writes and reads are submitted and then waited on, so several can be in
+// flight at once. Time is also taken from the transport, so an emulated
+// adapter can run on its own clock.
+////////////////////////////////////////////////////////////////////////////////
+
+#define BACKEND_FTDI					0			// libftdi, real hardware
+#define BACKEND_EMULATOR				1			// software FT2232H and flash
+#define BACKENDS						2
+
+extern const char* gBackendNames[BACKENDS];
+
+#define FTDI_DEVICE						0x6010
+
+// attached adapters, as found by FindAdapters
+struct AdapterInfo
+{
+	char serial[64];
+	char description[64];
+	u8 bus;
+	u8 address;
+};
+
+// USB settings, libftdi has no control of the USB buffer sizes themselves so
+// the chunk sizes are what we have. Writes are also split at writeChunk.
+struct TransportProfile
+{
+	u8 latencyMs;			// FTDI latency timer, 1-255
+	u32 readChunk;
+	u32 writeChunk;			// max TRANSPORT_BUFFER_SIZE
+};
+
+extern const TransportProfile gDefaultTransport;
+
+// a submitted transfer, only meaningful to the transport that made it
+struct TransportRequest;
+
+u64 TimeMicroseconds();
+
+class Transport
+{
+public:
+	virtual ~Transport() {}
+
+	// open the adapter (or the first found) in MPSSE mode on interface A
+	virtual bool Open(const AdapterInfo* pAdapter) = 0;
+	virtual void Close() = 0;
+	virtual bool Configure(const TransportProfile& profile) = 0;
+	virtual bool GetSerial(char* pSerial, u32 nSize) = 0;
+
+	// pData must stay valid until the request has been waited on, Wait
+	// returns the number of bytes transferred or < 0 on error
+	virtual TransportRequest* WriteSubmit(const void* pData, u32 nSize) = 0;
+	virtual TransportRequest* ReadSubmit(void* pData, u32 nSize) = 0;
+	virtual s32 Wait(TransportRequest* pRequest) = 0;
+
+	// clock
+	virtual u64 Now() { return TimeMicroseconds(); }
+	virtual void Delay(u32 ms);
+};
+
+Transport* TransportCreate(u8 nBackend, const char* pOption = 0);
+
+////////////////////////////////////////////////////////////////////////////////
+// libftdi
+////////////////////////////////////////////////////////////////////////////////
+
+struct ftdi_context;
+
+class FTDITransport : public Transport
+{
+public:
+	FTDITransport();
+	~FTDITransport();
+
+	static u32 FindAdapters(AdapterInfo* pList, u32 nMax);
+
+	bool Open(const AdapterInfo* pAdapter);
+	void Close();
+	bool Configure(const TransportProfile& profile);
+	bool GetSerial(char* pSerial, u32 nSize);
+	TransportRequest* WriteSubmit(const void* pData, u32 nSize);
+	TransportRequest* ReadSubmit(void* pData, u32 nSize);
+	s32 Wait(TransportRequest* pRequest);
+
+private:
+	FTDITransport(const FTDITransport&) = delete;
+	FTDITransport& operator=(const FTDITransport&) = delete;
+
+	ftdi_context* m_pFTDI;
+};
+
+#endif // _TRANSPORT_H_
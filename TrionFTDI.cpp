@@ -1,873 +1,469 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
 #include <math.h>
-#include "ftdi.h"
-#include "Types.h"
+#include <thread>
+#include "Platform.h"
+#include "ConfigSession.h"
+#include "Image.h"
+#include "Benchmark.h"
+#include "Trace.h"
 
-#pragma warning(disable:4302)
+#define GANG_MAX_ADAPTERS		32
+#define GANG_EMULATED_BOARDS	4			// default for -g on the emulator
+#define IMAGE_MAX_FILES			8			// files merged into one write
 
 ////////////////////////////////////////////////////////////////////////////////
-// FT2232H
-// Config Flash		JTAG
-// Channel A		Channel B
-// AD0, CCK			BD0, TCK
-// AD1, CDI0		BD1, TDI
-// AD2, CDI1		BD2, TDO
-// AD3, SS#			BD3, TMS
-// AD4, CRESET_N
-// AD5, CDONE
+// Command line helpers
 ////////////////////////////////////////////////////////////////////////////////
 
-#define CA_CCK							0x01
-#define CA_CDI0							0x02
-#define CA_CDI1							0x04
-#define CA_SS_N							0x08
-#define CA_CRESET_N						0x10
-#define CA_CDONE						0x20
-
-#define CB_TCK							0x01
-#define CB_TDI							0x02
-#define CB_TDO							0x04
-#define CB_TMS							0x08
-
-#define FTDI_DEVICE						0x6010
-
-////////////////////////////////////////////////////////////////////////////////
-// EEPROM commands
-////////////////////////////////////////////////////////////////////////////////
-
-#define CMD_READ_STATUS_REGISTER1		0x05
-#define CMD_READ_STATUS_REGISTER2		0x35
-#define CMD_READ_DEVICE_ID				0x90
-#define CMD_READ_UNIQUE_ID				0x4b
-#define CMD_WRITE_STATUS_REGISTERS		0x01
-#define CMD_WRITE_ENABLE				0x06
-#define CMD_SECTOR_ERASE				0x20		// 4K sector
-#define CMD_CHIP_ERASE					0x60
-#define CMD_BLOCK_ERASE_32K				0x52
-#define CMD_BLOCK_ERASE_64K				0xd8
-#define CMD_PROGRAM_PAGE				0x02		// 256 byte page
-#define CMD_READ_BYTES					0x03
-#define CMD_WAKE_UP						0xab
-#define CMD_RESET_ENABLE				0x66
-#define CMD_RESET						0x99
-
-#define	STATUS_IN_PROGRESS				0x01
-#define	STATUS_WRITE_ENABLE				0x02
-#define	STATUS_BLOCK_PROTECT_SHIFT		2
-#define	STATUS_BLOCK_PROTECT_MASK		0x001f
-#define	STATUS_REGISTER_PROTECT_SHIFT	7
-#define	STATUS_REGISTER_PROTECT_MASK	0x0180
-#define	STATUS_QUAD_ENABLE				0x0200
-
-////////////////////////////////////////////////////////////////////////////////
-// Terminate and free anything related to the device config
-////////////////////////////////////////////////////////////////////////////////
-
-ftdi_context* gFTDIA = 0;
-
-void ConfigTerm()
+u32 StringToNumber(const char* opt)
 {
-	if (gFTDIA)
+	int base = 10;
+	if (*opt == '$')
 	{
-		ftdi_usb_close(gFTDIA);
-		ftdi_free(gFTDIA);
-		gFTDIA = 0;
+		opt++;
+		base = 16;
 	}
-}
-
-////////////////////////////////////////////////////////////////////////////////
-// Set config pins to idle (all in)
-////////////////////////////////////////////////////////////////////////////////
-
-bool ConfigIdle()
-{
-	// commands to set all inputs
-	unsigned char buf[] =
+	else if (opt[0] == '0' && opt[1] == 'x')
 	{
-		SET_BITS_LOW,				// opcode: set low bits (ADBUS[0-7])
-		CA_SS_N | CA_CRESET_N,		// pin states
-		0							// pin direction, all input
-	};
-	const u32 buflen = sizeof(buf);
-
-	// write the setup to the chip.
-	return (ftdi_write_data(gFTDIA, buf, buflen) == buflen);
+		opt += 2;
+		base = 16;
+	}
+	return (u32)strtol(opt, NULL, base);
 }
 
-////////////////////////////////////////////////////////////////////////////////
-// Set config pins to active
-////////////////////////////////////////////////////////////////////////////////
-
-bool ConfigControl(u8 nBits)
+bool IsNumber(const char* opt)
 {
-	// commands to set useful initial state and drive output pins
-	unsigned char buf[] =
-	{
-		SET_BITS_LOW,									// opcode: set low bits (ADBUS[0-7])
-		nBits,											// pin states
-		CA_SS_N | CA_CRESET_N | CA_CDI0 | CA_CCK		// pin output, CRESET, SPI DO, CLK and SS
-	};
-	const u32 buflen = sizeof(buf);
-
-	// write the setup to the chip.
-	return (ftdi_write_data(gFTDIA, buf, buflen) == buflen);
-}
+	if (*opt == '$') opt++;
+	else if (opt[0] == '0' && opt[1] == 'x') opt += 2;
+	else if (!isdigit((u8)*opt)) return false;
 
-////////////////////////////////////////////////////////////////////////////////
-// Set CRESET_N / SS_N state
-////////////////////////////////////////////////////////////////////////////////
-
-u8 gGPIO = CA_CRESET_N | CA_SS_N;
-
-bool FPGAReset(bool bReset)
-{
-	if (bReset) gGPIO &= ~CA_CRESET_N;
-	else gGPIO |= CA_CRESET_N;
-	return ConfigControl(gGPIO);
+	return *opt && strspn(opt, "0123456789abcdefABCDEF") == strlen(opt);
 }
 
-bool ConfigChipSelect(bool bSelect)
+// SPI frequency in Mhz to kHz, clamped to what the MPSSE can do
+u32 FrequencyFromString(const char* opt)
 {
-	if (bSelect) gGPIO &= ~CA_SS_N;
-	else gGPIO |= CA_SS_N;
-	return ConfigControl(gGPIO);
+	float freq = (float) atof(opt);
+	if (freq > 30) freq = 30;
+	if (freq < 0.001f) freq = 0.001f;
+	return (u32) (freq * 1000.f);
 }
 
-////////////////////////////////////////////////////////////////////////////////
-// Initialise device config (config EEPROM, reset, etc...)
-////////////////////////////////////////////////////////////////////////////////
-
-#define SPI_6MHZ	9
-#define SPI_7_5MHZ	8
-#define SPI_10MHZ	5
-#define SPI_12MHZ	4
-#define SPI_15MHZ	3
-#define SPI_20MHZ	2
-#define SPI_30MHZ	1
-#define SPI_60MHZ	0
-
-////////////////////////////////////////////////////////////////////////////////
-
-bool ConfigInit(u8 speed = SPI_10MHZ)
+// split a comma separated option, returns the number of items
+u32 SplitList(const char* opt, char (*pItems)[32], u32 nMax)
 {
-	s32 ret;
-	
-	// initialise FTDI lib
-	if ((gFTDIA = ftdi_new()) == 0)
-	{
-		fprintf(stderr, "Unable to initialise libFTDI.\n");
-		return false;
-	}
-
-	// set for interface A (config eeprom SPI) and open
-	ftdi_set_interface(gFTDIA, INTERFACE_A);
-	if ((ret = ftdi_usb_open(gFTDIA, 0x0403, FTDI_DEVICE)) < 0)
-	{
-		fprintf(stderr, "Unable to open FTDI device: %d (%s)\n", ret, ftdi_get_error_string(gFTDIA));
-		ftdi_free(gFTDIA);
-		gFTDIA = 0;
-		return false;
-	}
-
-	// initialise MPSSE mode
-	ftdi_usb_reset(gFTDIA);
-	ftdi_set_bitmode(gFTDIA, 0, BITMODE_RESET);
-	ftdi_set_bitmode(gFTDIA, 0, BITMODE_MPSSE);
-
-	Sleep(50); // sleep 50 ms for setup to complete
-
-	ConfigIdle();
-
-	// setup SPI clocking etc...
-	unsigned char buf[] =
-	{
-		TCK_DIVISOR,		// opcode: set clk divisor
-		speed,				// argument: 60/(ARG+1)Mhz
-		0x00,				// argument: high
-		DIS_ADAPTIVE,		// opcode: disable adaptive clocking
-		DIS_3_PHASE,		// opcode: disable 3-phase clocking
-		SEND_IMMEDIATE
-	};
-	const u32 buflen = sizeof(buf);
-
-	// write the clocking setup and set to idle
-	if (!((ftdi_write_data(gFTDIA, buf, buflen) == buflen) && ConfigIdle()))
+	u32 nItems = 0;
+	while (*opt && nItems < nMax)
 	{
-		ConfigTerm();
-		fprintf(stderr, "Unable to initalise FTDI device for config.\n");
-		return false;
+		u32 len = (u32)strcspn(opt, ",");
+		if (len > 31) len = 31;
+		memcpy(pItems[nItems], opt, len);
+		pItems[nItems++][len] = 0;
+		opt += strcspn(opt, ",");
+		if (*opt) opt++;
 	}
-
-	// all setup and not interfering with reset, etc...
-	return true;
+	return nItems;
 }
 
-////////////////////////////////////////////////////////////////////////////////
-// Write SPI data
-////////////////////////////////////////////////////////////////////////////////
-
-bool ConfigWriteSPI(const void *pOutData, const int nLength, void *pInData = 0)
+// load and merge image files into one image, reporting any that fail
+bool LoadImages(Image* pImage, const char* const* ppFilenames, const u32* pAddresses, u32 nFiles)
 {
-	// initialise sending of data
-	unsigned char buf[] =
+	for (u32 n = 0; n < nFiles; n++)
 	{
-		(u8) (MPSSE_DO_WRITE | MPSSE_WRITE_NEG | (pInData != 0 ? MPSSE_DO_READ : 0)),
-		(u8) (nLength - 1),
-		(u8) ((nLength - 1) >> 8)
-	};
-	const u32 buflen = sizeof(buf);
-
-	// start send
-	bool bOk = ftdi_write_data(gFTDIA, buf, buflen) == buflen;
+		Image image;
+		if (!ImageLoad(&image, ppFilenames[n], pAddresses[n]))
+		{
+			printf("%s file unreadable or corrupt (%s).\n", gImageFormatNames[image.nFormat], ppFilenames[n]);
+			if (n) ImageFree(pImage);
+			return false;
+		}
 
-	// send data
-	if (bOk)
-	{
-		// data supplied
-		if (pOutData > (const void*)0xff)
+		if (n == 0)
 		{
-			bOk = ftdi_write_data(gFTDIA, (const unsigned char*)pOutData, nLength) == nLength;
+			*pImage = image;
 		}
-		// or write repeated character
-		else
+		else if (!ImageMerge(pImage, &image))
 		{
-			u8 byte = (u8)pOutData;
-			u32 count = nLength;
-			while (count-- && bOk)
-			{
-				bOk = ftdi_write_data(gFTDIA, &byte, 1) == 1;
-			}
+			printf("Error: %s overlaps an earlier file or is too far from it.\n", ppFilenames[n]);
+			ImageFree(pImage);
+			return false;
 		}
 	}
 
-	// read if needed
-	if (bOk && pInData) bOk = ftdi_read_data(gFTDIA, (unsigned char*)pInData, nLength) == nLength;
-
-	return bOk;
-}
-
-////////////////////////////////////////////////////////////////////////////////
-// Write single byte command over SPI
-////////////////////////////////////////////////////////////////////////////////
-
-bool ConfigWriteCommand(u8 cmd)
-{
-	const u32 buflen = 11;
-
-	u8 buf[buflen];
-	u8* ptr = buf;
-
-	*ptr++ = SET_BITS_LOW;
-	*ptr++ = gGPIO & ~CA_SS_N;
-	*ptr++ = CA_SS_N | CA_CRESET_N | CA_CDI0 | CA_CCK;
-
-	*ptr++ = (u8)(MPSSE_DO_WRITE | MPSSE_WRITE_NEG);
-	*ptr++ = 0;
-	*ptr++ = 0;
-
-	*ptr++ = cmd;
-
-	*ptr++ = SET_BITS_LOW;
-	*ptr++ = gGPIO | CA_SS_N;
-	*ptr++ = CA_SS_N | CA_CRESET_N | CA_CDI0 | CA_CCK;
-	*ptr++ = SEND_IMMEDIATE;
-
-	return ftdi_write_data(gFTDIA, buf, buflen) == buflen;
+	return nFiles != 0;
 }
 
-////////////////////////////////////////////////////////////////////////////////
-// Write command with data and return data of given size
-////////////////////////////////////////////////////////////////////////////////
-
-bool ConfigWriteCommandWithData(u8 cmd, const void *bufOut, void *bufIn, u32 size)
+// parse "file [addr] [file addr]..." after a write option, n is left on the last one used
+u32 ParseImageFiles(s32 argc, const char** argv, s32* n, const char** ppFilenames, u32* pAddresses)
 {
-	const u32 buflen = 11 + ((size > 0) ? (size + 3) : 0);
-	u8* buf = new u8[buflen];
-	u8* ptr = buf;
-	  
-	*ptr++ = SET_BITS_LOW;
-	*ptr++ = gGPIO & ~CA_SS_N;
-	*ptr++ = CA_SS_N | CA_CRESET_N | CA_CDI0 | CA_CCK;
-
-	*ptr++ = (u8)(MPSSE_DO_WRITE | MPSSE_WRITE_NEG);
-	*ptr++ = 0;
-	*ptr++ = 0;
-
-	*ptr++ = cmd;
-	
-	if (size)
+	u32 nFiles = 0;
+	while (nFiles < IMAGE_MAX_FILES && *n + 1 < argc && (nFiles == 0 || argv[*n + 1][0] != '-'))
 	{
-		*ptr++ = (u8)(MPSSE_DO_WRITE | MPSSE_WRITE_NEG | (bufIn != 0 ? MPSSE_DO_READ : 0));
-		*ptr++ = (u8)(size - 1);
-		*ptr++ = (u8)((size - 1) >> 8);
-
-		if (bufOut > (void*)0xff) memcpy(ptr, bufOut, size);
-		else memset(ptr, (u8)bufOut, size);
-		ptr += size;
-	}
-
-	*ptr++ = SET_BITS_LOW;
-	*ptr++ = gGPIO | CA_SS_N;
-	*ptr++ = CA_SS_N | CA_CRESET_N | CA_CDI0 | CA_CCK;
-	*ptr++ = SEND_IMMEDIATE;
-
-	// write the command stream
-	bool bOk = ftdi_write_data(gFTDIA, buf, buflen) == buflen;
-
-	// if we need to read data back as well, do it now
-	if (bOk && bufIn)
-	{
-		bOk = ftdi_read_data(gFTDIA, (unsigned char*)bufIn, size) == size;
+		ppFilenames[nFiles] = argv[++*n];
+		pAddresses[nFiles] = 0;
+		if (*n + 1 < argc && IsNumber(argv[*n + 1]))
+		{
+			pAddresses[nFiles] = StringToNumber(argv[++*n]);
+		}
+		nFiles++;
 	}
-
-	delete buf;
-	return bOk;
+	return nFiles;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-// Write command with address and return data of given size
+// Gang programming, one image to every attached adapter at once
 ////////////////////////////////////////////////////////////////////////////////
 
-bool ConfigWriteCommandWithAddrAndData(u8 cmd, u32 addr, const void *bufOut, void *bufIn, u32 size)
+struct GangBoard
 {
-	const u32 buflen = 14 + ((size > 0) ? (size + 3) : 0);
-	u8* buf = new u8[buflen];
-	u8* ptr = buf;
-	  
-	*ptr++ = SET_BITS_LOW;
-	*ptr++ = gGPIO & ~CA_SS_N;
-	*ptr++ = CA_SS_N | CA_CRESET_N | CA_CDI0 | CA_CCK;
-
-	*ptr++ = (u8)(MPSSE_DO_WRITE | MPSSE_WRITE_NEG);
-	*ptr++ = 4 - 1;
-	*ptr++ = 0;
-
-	*ptr++ = cmd;
-	*ptr++ = addr >> 16;
-	*ptr++ = addr >> 8;
-	*ptr++ = addr;
-	
-	if (size)
-	{
-		*ptr++ = (u8)(MPSSE_DO_WRITE | MPSSE_WRITE_NEG | (bufIn != 0 ? MPSSE_DO_READ : 0));
-		*ptr++ = (u8)(size - 1);
-		*ptr++ = (u8)((size - 1) >> 8);
-
-		if (bufOut > (void*)0xff) memcpy(ptr, bufOut, size);
-		else memset(ptr, (u8)bufOut, size);
-		ptr += size;
-	}
-
-	*ptr++ = SET_BITS_LOW;
-	*ptr++ = gGPIO | CA_SS_N;
-	*ptr++ = CA_SS_N | CA_CRESET_N | CA_CDI0 | CA_CCK;
-	*ptr++ = SEND_IMMEDIATE;
-
-	// write the command stream
-	bool bOk = ftdi_write_data(gFTDIA, buf, buflen) == buflen;
-
-	// if we need to read data back as well, do it now
-	if (bOk && bufIn)
+	AdapterInfo adapter;
+	u8 nBackend;
+	char flash[256];							// emulated flash file, if any
+	bool bOk;
+	u64 elapsedUs;								// session time, virtual on the emulator
+};
+
+void GangWorker(GangBoard* pBoard, const Image* pImage, u8 mode, u32 frequency, bool bClockCache, const TransportProfile* pProfile)
+{
+	// each board gets its own session, and stays quiet so output isn't interleaved
+	ConfigSession session;
+	session.SetQuiet(true);
+	session.SetBackend(pBoard->nBackend, pBoard->flash[0] ? pBoard->flash : 0);
+	session.SetTransport(*pProfile);
+
+	pBoard->bOk = false;
+	pBoard->elapsedUs = 0;
+	if (session.Init(frequency == SPI_AUTO ? AUTOCLOCK_SAFE_FREQUENCY : frequency, &pBoard->adapter))
 	{
-		bOk = ftdi_read_data(gFTDIA, (unsigned char*)bufIn, size) == size;
+		// timed on the session's clock so the emulator's figures mean something
+		const u64 startTime = session.Now();
+		session.WakeUp();
+		session.Reset();
+		session.Identify();
+		if (frequency == SPI_AUTO) session.AutoFrequency(bClockCache);
+		pBoard->bOk = session.ProgramImage(pImage, mode);
+		pBoard->elapsedUs = session.Now() - startTime;
+		session.Idle();
+		session.Term();
 	}
-
-	delete buf;
-	return bOk;
-}
-
-////////////////////////////////////////////////////////////////////////////////
-// 
-////////////////////////////////////////////////////////////////////////////////
-
-bool ConfigReset()
-{
-	return ConfigWriteCommand(CMD_RESET_ENABLE) && ConfigWriteCommand(CMD_RESET);
-}
-
-////////////////////////////////////////////////////////////////////////////////
-//
-// Wake up if the EEPROM has been put to sleep (Trion will do this after config)
-//
-////////////////////////////////////////////////////////////////////////////////
-
-bool ConfigWakeUp()
-{
-	return ConfigWriteCommand(CMD_WAKE_UP);
-}
-
-////////////////////////////////////////////////////////////////////////////////
-// Read config device id
-////////////////////////////////////////////////////////////////////////////////
-
-bool ConfigReadDeviceId(u16 *id)
-{
-	return ConfigWriteCommandWithAddrAndData(CMD_READ_DEVICE_ID, 0, 0, id, 2);
-}
-
-////////////////////////////////////////////////////////////////////////////////
-// Read config device id
-////////////////////////////////////////////////////////////////////////////////
-
-bool ConfigReadUniqueId(void *uid)
-{
-	// read into temp buffer with dummy byte
-	char temp[17];
-	bool r = ConfigWriteCommandWithAddrAndData(CMD_READ_UNIQUE_ID, 0, 0, temp, 17);
-
-	// skip dummy and just return uid
-	memcpy(uid, temp + 1, 16);
-	
-	return r;
 }
 
-////////////////////////////////////////////////////////////////////////////////
-// Enable write to chip
-////////////////////////////////////////////////////////////////////////////////
-
-bool ConfigWriteEnable()
+// on the emulator there are nEmulated boards, each with its own flash file
+// named after pBackendOption if one was given
+bool GangProgram(const char* const* ppFilenames, const u32* pAddresses, u32 nFiles, u8 mode, u32 frequency, bool bClockCache, const TransportProfile* pProfile,
+	u8 nBackend, const char* pBackendOption, u32 nEmulated)
 {
-	return ConfigWriteCommand(CMD_WRITE_ENABLE);
-}
-
-////////////////////////////////////////////////////////////////////////////////
-// Poll until operation is complete
-////////////////////////////////////////////////////////////////////////////////
-
-bool ConfigPollStatusComplete()
-{
-	bool bOk = false;
-
-	if (	ConfigChipSelect(true) &&
-			ConfigWriteSPI((void*)CMD_READ_STATUS_REGISTER1, 1, 0))
+	GangBoard* boards = new GangBoard[GANG_MAX_ADAPTERS];
+	AdapterInfo adapters[GANG_MAX_ADAPTERS];
+	u32 count = 0;
+	if (nBackend == BACKEND_EMULATOR)
 	{
-		u32 timeout = 20;
-		u8 status;
-		do
+		count = nEmulated < GANG_MAX_ADAPTERS ? nEmulated : GANG_MAX_ADAPTERS;
+		for (u32 n = 0; n < count; n++)
 		{
-			// wait a bit to stop spamming libFTDI (it doesnt like it)
-			Sleep(1);
-			bOk = ConfigWriteSPI(0, 1, &status);
+			memset(&adapters[n], 0, sizeof(AdapterInfo));
+			snprintf(adapters[n].serial, sizeof(adapters[n].serial), "EMULATOR%d", n + 1);
+			adapters[n].address = (u8)(n + 1);
 		}
-		while (--timeout && bOk & (status & STATUS_IN_PROGRESS));
-		
-		bOk &= ConfigChipSelect(false) && timeout != 0;
 	}
-
-	return bOk;
-}
-
-////////////////////////////////////////////////////////////////////////////////
-// Get status registers
-////////////////////////////////////////////////////////////////////////////////
-
-bool ConfigGetStatus(u16 *status)
-{
-	return	ConfigWriteCommandWithData(CMD_READ_STATUS_REGISTER1, 0, status, 1) &&
-			ConfigWriteCommandWithData(CMD_READ_STATUS_REGISTER2, 0, ((u8*)status) + 1, 1);
-}
-
-////////////////////////////////////////////////////////////////////////////////
-// Set status registers
-////////////////////////////////////////////////////////////////////////////////
-
-bool ConfigSetStatus(const u16 status)
-{
-	return	ConfigWriteEnable() &&
-			ConfigWriteCommandWithData(CMD_WRITE_STATUS_REGISTERS, &status, 0, 2) &&
-			ConfigPollStatusComplete();
-}
-
-////////////////////////////////////////////////////////////////////////////////
-// Erase whole chip
-////////////////////////////////////////////////////////////////////////////////
-
-bool ConfigEraseAll()
-{
-	return	ConfigWriteEnable() &&
-			ConfigWriteCommand(CMD_CHIP_ERASE) &&
-			ConfigPollStatusComplete();
-}
-
-////////////////////////////////////////////////////////////////////////////////
-// Erase sector (4K)
-////////////////////////////////////////////////////////////////////////////////
-
-bool ConfigEraseSector(u32 addr)
-{
-	return	ConfigWriteEnable() &&
-			ConfigWriteCommandWithAddrAndData(CMD_SECTOR_ERASE, addr, 0, 0, 0) &&
-			ConfigPollStatusComplete();
-}
-
-////////////////////////////////////////////////////////////////////////////////
-// Erase block (32K/64K)
-////////////////////////////////////////////////////////////////////////////////
-
-bool ConfigEraseBlock32(u32 addr)
-{
-	return	ConfigWriteEnable() &&
-			ConfigWriteCommandWithAddrAndData(CMD_BLOCK_ERASE_32K, addr, 0, 0, 0) &&
-			ConfigPollStatusComplete();
-}
-
-bool ConfigEraseBlock64(u32 addr)
-{
-	return	ConfigWriteEnable() &&
-			ConfigWriteCommandWithAddrAndData(CMD_BLOCK_ERASE_64K, addr, 0, 0, 0) &&
-			ConfigPollStatusComplete();
-}
-
-////////////////////////////////////////////////////////////////////////////////
-// Erase given area
-////////////////////////////////////////////////////////////////////////////////
-
-bool ConfigEraseArea(u32 addr, u32 size)
-{
-	bool bOk = true;
-	
-	// align start address and size to 4K sectors (minimum erase size)
-	size += (4096 - (addr & 4095)) & 4095;
-	addr &= ~4095;
-	size = (size + 4095) & ~4095;
-
-	while (bOk && size)
+	else
 	{
-		// aligned to 64K
-		if (((addr & 65535) == 0) && (size >= 65536))
-		{
-			bOk = ConfigEraseBlock64(addr);
-			addr += 65536;
-			size -= 65536;
-		}
-		else if (((addr & 32767) == 0) && (size >= 32768))
-		{
-			bOk = ConfigEraseBlock32(addr);
-			addr += 32768;
-			size -= 32768;
-		}
-		else
-		{
-			bOk = ConfigEraseSector(addr);
-			addr += 4096;
-			size -= 4096;
-		}
+		count = ConfigSession::FindAdapters(adapters, GANG_MAX_ADAPTERS);
 	}
-
-	return bOk;
-}
-
-////////////////////////////////////////////////////////////////////////////////
-// Write page (max 256 bytes), data will wrap within 256 byte page, so max
-// sequential write is 256-(addr&255).
-////////////////////////////////////////////////////////////////////////////////
-
-bool ConfigWritePage(u32 nAddress, const void* pData, u32 nSize = 256)
-{
-	if (nSize > 256)
+	if (!count)
 	{
+		printf("Error: No adapters found.\n");
+		delete[] boards;
 		return false;
 	}
 
-	return	ConfigWriteEnable() &&
-			ConfigWriteCommandWithAddrAndData(CMD_PROGRAM_PAGE, nAddress, pData, 0, nSize) &&
-			ConfigPollStatusComplete();
-}
-
-////////////////////////////////////////////////////////////////////////////////
-// Read bytes starting at address given
-////////////////////////////////////////////////////////////////////////////////
+	// the image is loaded once and shared by all boards
+	Image image;
+	if (!LoadImages(&image, ppFilenames, pAddresses, nFiles))
+	{
+		delete[] boards;
+		return false;
+	}
 
-bool ConfigReadBytes(u32 nAddress, void* pData, u32 nSize = 256)
-{
-	return	ConfigWriteCommandWithAddrAndData(CMD_READ_BYTES, nAddress, 0, pData, nSize);
-}
+	printf("Gang programming %s%s to %d adapters... ", ppFilenames[0], nFiles > 1 ? " and others" : "", count);
+	fflush(stdout);
 
-////////////////////////////////////////////////////////////////////////////////
-// Show info on connected EEPROM
-////////////////////////////////////////////////////////////////////////////////
-
-void ShowDeviceInfo()
-{
-	u16 id = 0xffff;
-	ConfigReadDeviceId(&id);
-	const char* pDev = "Unknown";
-	switch (id)
+	std::thread* threads = new std::thread[count];
+	for (u32 n = 0; n < count; n++)
 	{
-	case 0x13c8:
-		pDev = "GigaDevices GD25Q80E";
-		break;
+		boards[n].adapter = adapters[n];
+		boards[n].nBackend = nBackend;
+		boards[n].flash[0] = 0;
+		if (pBackendOption) snprintf(boards[n].flash, sizeof(boards[n].flash), "%s.%d", pBackendOption, n + 1);
+		threads[n] = std::thread(GangWorker, &boards[n], &image, mode, frequency, bClockCache, pProfile);
 	}
 
-	fprintf(stdout, "Config manufacturer / device ID %04X (%s)\n", id, pDev);
+	u32 passed = 0;
+	for (u32 n = 0; n < count; n++)
+	{
+		threads[n].join();
+		if (boards[n].bOk) passed++;
+	}
+	printf("done\n");
 
-	u8 uid[16];
-	ConfigReadUniqueId(&uid);
-	fprintf(stdout, "Config unique ID ");
-	for (u32 n = 0; n < 16; n++)
+	// report per board, so failures can be traced back to an adapter
+	for (u32 n = 0; n < count; n++)
 	{
-		fprintf(stdout, "%02X", uid[n]);
+		const GangBoard* b = &boards[n];
+		printf("  %-16s %03d:%03d  %s  %.2fs", b->adapter.serial[0] ? b->adapter.serial : "(no serial)", b->adapter.bus, b->adapter.address, b->bOk ? "OK!    " : "FAILED!", b->elapsedUs / 1000000.0);
+		if (b->bOk && b->elapsedUs) printf("  %.2fMB/s", (double)image.nSize / b->elapsedUs);
+		printf("\n");
 	}
-	fprintf(stdout, "\n");
+	printf("%d of %d passed.\n", passed, count);
 
-	u16 status;
-	ConfigGetStatus(&status);
-	fprintf(stdout, "Status: %04x (QE: %s)\n", status, status & STATUS_QUAD_ENABLE ? "Yes" : "No");
+	delete[] threads;
+	ImageFree(&image);
+	delete[] boards;
+	return passed == count;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-// Parse hex file to get size and validity
+// CLI main
 ////////////////////////////////////////////////////////////////////////////////
 
-s32 HexGetSize(const char* pFilename)
+int main(int argc, const char **argv)
 {
-	s32 nFileSize = -1;
-	FILE* f;
-	if (fopen_s(&f, pFilename, "rt") == 0)
+	const char* pFilename = "testbed.hex";
+
+	u32 nSPIFreq = SPI_15MHZ;
+	bool bClockCache = true;
+	u8 nBackend = BACKEND_FTDI;
+	const char* pBackendOption = 0;
+	u32 nEmulatedBoards = GANG_EMULATED_BOARDS;
+	TransportProfile transport = gDefaultTransport;
+	BenchConfig bench;
+	bool bBenchClocks = false;
+	char items[BENCH_MAX_VALUES][32];
+	BenchDefaults(&bench);
+	bool bStats = false;
+	const char* pStatsFile = 0;
+	const char* pCaptureFile = 0;
+
+	if (argc == 1)
+	{
+		printf("Usage: %s [commands]\n\n"
+			"Commands:\n"
+			"-f {freq|auto|search}     Set SPI frequency (Mhz, 0.001-30), default 15Mhz, rounded down to 30/n Mhz for any n up to 30000\n"
+			"                          auto finds the fastest reliable clock (cached per adapter and flash), search ignores the cache\n"
+			"-lt {ms}                  Set USB latency timer, default 1ms\n"
+			"-cs {read} [write]        Set USB read and write chunk sizes, default 65536\n"
+			"-tt                       Time candidate USB settings and use the fastest\n"
+			"-emu [flash.bin]          Use the software adapter and flash emulator, contents kept in flash.bin if given\n"
+			"-boards {count}           Number of adapters -g emulates with -emu, default 4, each keeping its flash in flash.bin.N\n"
+			"-i                        Display chip information\n"
+			"-c                        Trigger FPGA config\n"
+			"-q [on|off]               Enable or disable quad spi flag\n"
+			"-e [addr size]            Erase area (whole chip by default, use $ or 0x for hex)\n"
+			"-w[ev] file [addr] ...    Write image files with optial [e]rase and [v]erify to address (default 0, use $ or 0x for hex)\n"
+			"-wd[v] file [addr]        Write image file, only erasing and programming sectors that have changed\n"
+			"-v file [addr]            Verify contents of config prom at address match this file\n"
+			"                          Files may be Efinix .hex or .bit, Intel HEX (addresses offset by addr) or raw .bin,\n"
+			"                          several files are written together as one image, - streams from stdin\n"
+			"-rm {auto|normal|fast|dual} Set read mode used for verify and readback, default auto\n"
+			"-rt [addr size]           Time a read in the current read mode and check it against a normal read\n"
+			"-hb file.hex              Benchmark the hex decoders on this file, only option processed\n"
+			"-selftest                 Check the SPI clock planning for every rate and streamed input shutdown, only option processed\n"
+			"-g[edv] file [addr] ...   Gang program image files to every attached adapter in parallel, only option processed\n"
+			"                          -emu runs it on -boards emulated adapters\n"
+			"-stats [file.json]        Show time, USB traffic and latency per operation at the end, and save them as JSON\n"
+			"-capture file.trace       Record all USB traffic with timestamps to the file\n"
+			"-trace file.trace [list]  Decode a capture into SPI transactions and report the gaps between them, only option processed\n"
+			"-bench [file.json]        Benchmark erase, program, verify and read, JSON to the file or stdout, only option processed\n"
+			"                          Overwrites the flash from address 0, -emu runs it on the emulator\n"
+			"-bs {KB,...}              Benchmark sizes, default 64,1024\n"
+			"-bf {freq|auto,...}       Benchmark SPI frequencies (Mhz), default as -f\n"
+			"-bm {mode,...}            Benchmark read modes for verify and read, default normal,fast,dual\n"
+			, argv[0]);
+	}
+	
+	// first do a pass to get the SPI frequency for initialisation
+	for (s32 n = 1; n < argc; n++)
 	{
-		nFileSize = 0;
-		// scan and see how big it is in actual binary terms
-		while (1)
+		if (_stricmp(argv[n], "-f") == 0)
 		{
-			char c = fgetc(f);
-			if (feof(f))
+			n++;
+			if (n < argc && (_stricmp(argv[n], "auto") == 0 || _stricmp(argv[n], "search") == 0))
 			{
-				break;
+				nSPIFreq = SPI_AUTO;
+				bClockCache = _stricmp(argv[n], "auto") == 0;
 			}
-
-			// lowercase
-			c = tolower(c);
-
-			// see if character is valid hex
-			if ((c >= 'a' && c <= 'f') ||
-				(c >= '0' && c <= '9'))
+			else if (n < argc)
+			{
+				nSPIFreq = FrequencyFromString(argv[n]);
+ 			}
+		}
+		else if (_stricmp(argv[n], "-bs") == 0 && n + 1 < argc)
+		{
+			bench.nSizes = SplitList(argv[++n], items, BENCH_MAX_VALUES);
+			for (u32 i = 0; i < bench.nSizes; i++)
 			{
-				nFileSize++;
+				bench.sizes[i] = StringToNumber(items[i]) * 1024;
 			}
-
-			// on an invalid character (non-hex and non-whitespace) return error
-			else if (c != 9 && c != ' ' && c != 10 && c != 13 && c != 0)
+		}
+		else if (_stricmp(argv[n], "-bf") == 0 && n + 1 < argc)
+		{
+			bench.nClocks = SplitList(argv[++n], items, BENCH_MAX_VALUES);
+			for (u32 i = 0; i < bench.nClocks; i++)
 			{
-				nFileSize = -1;
-				break;
+				bench.clocks[i] = _stricmp(items[i], "auto") == 0 ? SPI_AUTO : FrequencyFromString(items[i]);
 			}
+			bBenchClocks = true;
 		}
+		else if (_stricmp(argv[n], "-bm") == 0 && n + 1 < argc)
+		{
+			const u32 nItems = SplitList(argv[++n], items, BENCH_MAX_VALUES);
+			bench.nReadModes = 0;
+			for (u32 i = 0; i < nItems; i++)
+			{
+				u8 mode = COUNTOF(gReadModeNames);
+				for (u8 m = 0; m < COUNTOF(gReadModeNames); m++)
+				{
+					if (_stricmp(items[i], gReadModeNames[m]) == 0) mode = m;
+				}
 
-		fclose(f);
-	}
-
-	return nFileSize >> 1;
-}
-
-////////////////////////////////////////////////////////////////////////////////
-// Get number of bytes of binary from hex file
-////////////////////////////////////////////////////////////////////////////////
-
-u32 HexGetBytes(void* buf, FILE* f, u32 size)
-{
-	u8 data = 0;
-	u32 nibbles = 0;
-	u8* out = (u8*)buf;
-	
-	while (size)
-	{
-		char c = fgetc(f);
-		if (feof(f))
+				if (mode < COUNTOF(gReadModeNames)) bench.readModes[bench.nReadModes++] = mode;
+				else printf("Error: Unknown read mode (%s).\n", items[i]);
+			}
+		}
+		else if (_stricmp(argv[n], "-stats") == 0)
 		{
-			break;
+			bStats = true;
+			if (((n + 1) < argc) && argv[n+1][0] != '-')
+			{
+				pStatsFile = argv[++n];
+			}
 		}
-
-		// lowercase
-		c = tolower(c);
-
-		// get nibble from character
-		bool added = true;
-		if (c >= 'a' && c <= 'f')
+		else if (_stricmp(argv[n], "-capture") == 0)
 		{
-			data <<= 4;
-			data |= c - ('a' - 10);
+			n++;
+			if (n < argc) pCaptureFile = argv[n];
 		}
-		else if (c >= '0' && c <= '9')
+		else if (_stricmp(argv[n], "-emu") == 0)
 		{
-			data <<= 4;
-			data |= c - '0';
+			nBackend = BACKEND_EMULATOR;
+			if (((n + 1) < argc) && argv[n+1][0] != '-')
+			{
+				pBackendOption = argv[++n];
+			}
 		}
-		else
+		else if (_stricmp(argv[n], "-boards") == 0)
 		{
-			added = false;
+			n++;
+			if (n < argc) nEmulatedBoards = StringToNumber(argv[n]);
 		}
-
-		// if a whole byte has been read, write it out
-		if (added && (nibbles++ & 1))
+		else if (_stricmp(argv[n], "-lt") == 0)
 		{
-			*out++ = data;
-			size--;
+			n++;
+			if (n < argc)
+			{
+				u32 latency = StringToNumber(argv[n]);
+				transport.latencyMs = (u8)(latency < 1 ? 1 : latency > 255 ? 255 : latency);
+			}
 		}
-	}
-
-	return nibbles >> 1;
-}
-
-////////////////////////////////////////////////////////////////////////////////
-// Program hex file
-// Optionally erase only the blocks affected and also verify once complete
-////////////////////////////////////////////////////////////////////////////////
-
-#define PROG_ERASE			1
-#define PROG_PROGRAM		2
-#define PROG_VERIFY			4
-
-////////////////////////////////////////////////////////////////////////////////
-
-void ConfigProgramHex(const char* pFilename, const u32 writeAddr, const u8 mode = PROG_PROGRAM | PROG_ERASE | PROG_VERIFY)
-{
-	s32 hexSize = HexGetSize(pFilename);
-	if (hexSize < 0) printf("Hex file corrupt (%s).\n", pFilename);
-	else
-	{
-		for (u32 n = 0; n < 3; n++)
+		else if (_stricmp(argv[n], "-cs") == 0)
 		{
-			if (mode & (1 << n))
+			n++;
+			if (n < argc)
 			{
-				if (n == 0)
-				{
-					printf("Erasing ($%x-$%x)... ", writeAddr, writeAddr + ((hexSize + 4095) & ~4095) - 1);
-					if (ConfigEraseArea(writeAddr, hexSize)) printf("OK!\n");
-					else
-					{
-						printf("FAILED!\n");
-						break;
-					}
-				}
-				else
+				transport.readChunk = transport.writeChunk = StringToNumber(argv[n]);
+				if (((n + 1) < argc) && argv[n+1][0] != '-')
 				{
-					if (n == 1) printf("Programming ($%x-$%x)... ", writeAddr, writeAddr + hexSize - 1);
-					else printf("Verifying... ");
-
-					s32 percent = -1;
-					u32 addr = writeAddr;
-					FILE* f;
-					if (fopen_s(&f, pFilename, "rt") == 0)
-					{
-						u32 totalOut = 0;
-						while (totalOut < (u32) hexSize)
-						{
-							// read in the next page
-							u8 buf[256];
-							u32 read = HexGetBytes(buf, f, 256);
-
-							// verify
-							if (n == 2)
-							{
-								u8 buf2[256];
-								if (!ConfigReadBytes(addr, buf2, read) || memcmp(buf, buf2, read) != 0)
-								{
-									break;
-								}
-							}
-
-							// program
-							else
-							{
-								// write it to the config prom
-								if (!ConfigWritePage(addr, buf, read))
-								{
-									break;
-								}
-							}
-
-							// update progress
-							s32 npercent = (totalOut * 100) / hexSize;
-							if (npercent != percent)
-							{
-								percent = npercent;
-								printf("%02d%%\b\b\b", percent);
-							}
-
-							addr += read;
-							totalOut += read;
-						}
-						fclose(f);
-
-						// report how we did
-						if (totalOut == hexSize)
-						{
-							printf("OK!\n");
-						}
-						else
-						{
-							printf("FAILED!\n");
-						}
-					}
+					n++;
+					transport.writeChunk = StringToNumber(argv[n]);
 				}
 			}
 		}
 	}
-}
-
-////////////////////////////////////////////////////////////////////////////////
-// CLI main
-////////////////////////////////////////////////////////////////////////////////
 
-u32 StringToNumber(const char* opt)
-{
-	int base = 10;
-	if (*opt == '$')
-	{
-		opt++;
-		base = 16;
-	}
-	else if (opt[0] == '0' && opt[1] == 'x')
+	// gang programming and benchmarks take over from the single adapter commands
+	for (s32 n = 1; n < argc; n++)
 	{
-		opt += 2;
-		base = 16;
-	}
-	return (u32)strtol(opt, NULL, base);
-}
+		if (_stricmp(argv[n], "-hb") == 0)
+		{
+			if (n + 1 < argc) HexBenchmark(argv[n + 1]);
+			else printf("Error: No filename specified.\n");
+			return 0;
+		}
 
-int main(int argc, const char **argv)
-{
-	const char* pFilename = "testbed.hex";
+		if (_stricmp(argv[n], "-selftest") == 0)
+		{
+			const bool bClock = MPSSEClockSelfTest();
+			const bool bStream = ImageStreamSelfTest();
+			return bClock && bStream ? 0 : 1;
+		}
 
-	u8 nSPIFreq = SPI_20MHZ;
+		if (_stricmp(argv[n], "-trace") == 0)
+		{
+			if (n + 1 < argc) return TraceAnalyse(argv[n + 1], n + 2 < argc && _stricmp(argv[n + 2], "list") == 0) ? 0 : 1;
+			printf("Error: No filename specified.\n");
+			return 1;
+		}
 
-	if (argc == 1)
-	{
-		printf("Usage: %s [commands]\n\n"
-			"Commands:\n"
-			"-f {freq}                 Set SPI frequency (Mhz), default 20Mhz\n"
-			"-i                        Display chip information\n"
-			"-c                        Trigger FPGA config\n"
-			"-q [on|off]               Enable or disable quad spi flag\n"
-			"-e [addr size]            Erase area (whole chip by default, use $ or 0x for hex)\n"
-			"-w[ev] file.hex [addr]    Write hex file with optial [e]rase and [v]erify to address (default 0, use $ or 0x for hex)\n"
-			"-v file.hex [addr]        Verify contents of config prom at address match this file\n"
-			, argv[0]);
-	}
-	
-	// first do a pass to get the SPI frequency for initialisation
-	for (s32 n = 1; n < argc; n++)
-	{
-		if (_stricmp(argv[n], "-f") == 0)
+		if (_stricmp(argv[n], "-bench") == 0)
 		{
-			n++;
-			if (n < argc)
+			if (((n + 1) < argc) && argv[n+1][0] != '-')
 			{
-				float freq = (float) atof(argv[n]);
-				if (freq > 60) freq = 60;
-				if (freq < 6) freq = 6;
-				nSPIFreq = (u32) ceil(60.f / freq) - 1;
- 			}
+				bench.pOutput = argv[n + 1];
+			}
+			if (!bBenchClocks)
+			{
+				bench.clocks[0] = nSPIFreq;
+				bench.nClocks = 1;
+			}
+			bench.bClockCache = bClockCache;
+
+			return Benchmark(&bench, nBackend, pBackendOption, &transport) ? 0 : 1;
+		}
+
+		if (_strnicmp(argv[n], "-g", 2) == 0)
+		{
+			u8 param = PROG_PROGRAM;
+			char c;
+			const char* opt = argv[n] + 2;
+			while ((c = *opt++))
+			{
+				c = tolower(c);
+				if (c == 'e') param |= PROG_ERASE;
+				else if (c == 'v') param |= PROG_VERIFY;
+				else if (c == 'd') param |= PROG_DIFFERENTIAL;
+			}
+
+			const char* files[IMAGE_MAX_FILES];
+			u32 addresses[IMAGE_MAX_FILES];
+			u32 nFiles = ParseImageFiles(argc, argv, &n, files, addresses);
+			if (!nFiles)
+			{
+				printf("Error: No filename specified.\n");
+				return 1;
+			}
+
+			return GangProgram(files, addresses, nFiles, param, nSPIFreq, bClockCache, &transport, nBackend, pBackendOption, nEmulatedBoards) ? 0 : 1;
 		}
 	}
 
 	// initialise config programming
-	if (ConfigInit(nSPIFreq))
+	ConfigSession session;
+	SessionStats stats;
+	StatsReset(&stats);
+	if (bStats) session.SetStats(&stats);
+	session.SetBackend(nBackend, pBackendOption);
+	session.SetCapture(pCaptureFile);
+	session.SetTransport(transport);
+	if (session.Init(nSPIFreq == SPI_AUTO ? AUTOCLOCK_SAFE_FREQUENCY : nSPIFreq))
 	{
 		// wake up and reset the chip incase it has been powered down
-		ConfigWakeUp();
-		ConfigReset();
+		session.WakeUp();
+		session.Reset();
+		session.Identify();
+		if (nSPIFreq == SPI_AUTO) session.AutoFrequency(bClockCache);
 		
 		// process other commands in order
 		for (s32 n = 1; n < argc; n++)
@@ -875,8 +471,15 @@ int main(int argc, const char **argv)
 			// info
 			if (_stricmp(argv[n], "-i") == 0)
 			{
-				printf("SPI frequency %dMhz\n", 60 / (nSPIFreq + 1));
-				ShowDeviceInfo();
+				const MPSSEClock& clock = session.Clock();
+				printf("SPI frequency %.3fMhz (divisor %d%s)\n", clock.nFrequency / 1000000.0, clock.nDivisor, clock.bDiv5 ? ", divide by 5" : "");
+				session.ShowDeviceInfo();
+			}
+
+			// transport tuning
+			else if (_stricmp(argv[n], "-tt") == 0)
+			{
+				session.TuneTransport();
 			}
 
 			// quad mode
@@ -891,22 +494,58 @@ int main(int argc, const char **argv)
 				
 				// change quad mode if needed
 				u16 status;
-				ConfigGetStatus(&status);
+				session.GetStatus(&status);
 				if (!!(status & STATUS_QUAD_ENABLE) != bQuad)
 				{
 					status &= ~STATUS_QUAD_ENABLE;
 					if (bQuad) status |= STATUS_QUAD_ENABLE;
-					ConfigSetStatus(status);
+					session.SetStatus(status);
 				}
 			}
 
+			// read mode
+			else if (_stricmp(argv[n], "-rm") == 0)
+			{
+				n++;
+				if (n < argc)
+				{
+					u8 mode = COUNTOF(gReadModeNames);
+					for (u8 m = 0; m < COUNTOF(gReadModeNames); m++)
+					{
+						if (_stricmp(argv[n], gReadModeNames[m]) == 0) mode = m;
+					}
+
+					if (mode < COUNTOF(gReadModeNames)) session.SetReadMode(mode);
+					else printf("Error: Unknown read mode (%s).\n", argv[n]);
+				}
+			}
+
+			// read test
+			else if (_stricmp(argv[n], "-rt") == 0)
+			{
+				u32 nStartAddress = 0;
+				u32 nSize = 65536;
+				if (((n + 1) < argc) && argv[n+1][0] != '-')
+				{
+					n++;
+					nStartAddress = StringToNumber(argv[n]);
+					if (((n + 1) < argc) && argv[n+1][0] != '-')
+					{
+						n++;
+						nSize = StringToNumber(argv[n]);
+					}
+				}
+
+				if (nSize) session.ReadTest(nStartAddress, nSize);
+			}
+
 			// FPGA config
 			else if (_stricmp(argv[n], "-c") == 0)
 			{
-				FPGAReset(true);
-				Sleep(50);
-				ConfigWakeUp();
-				ConfigReset();
+				session.FPGAReset(true);
+				session.Delay(50);
+				session.WakeUp();
+				session.Reset();
 			}
 
 			// erase chip
@@ -928,13 +567,13 @@ int main(int argc, const char **argv)
 				if (nStartAddress == 0 && nSize == 0)
 				{
 					printf("Erasing (all)... ");
-					if (ConfigEraseAll()) printf("OK!\n");
+					if (session.EraseAll()) printf("OK!\n");
 					else printf("FAILED!\n");
 				}
 				else
 				{
 					printf("Erasing ($%x-$%x)... ", nStartAddress, nStartAddress + ((nSize + 4095) & ~4095) - 1);
-					if (ConfigEraseArea(nStartAddress, nSize)) printf("OK!\n");
+					if (session.EraseArea(nStartAddress, nSize)) printf("OK!\n");
 					else printf("FAILED!\n");
 				}
 			}
@@ -956,22 +595,36 @@ int main(int argc, const char **argv)
 						c = tolower(c);
 						if (c == 'e') param |= PROG_ERASE;
 						else if (c == 'v') param |= PROG_VERIFY;
+						else if (c == 'd') param |= PROG_DIFFERENTIAL;
 					}
 				}
 
-				n++;
-				if (n < argc)
+				const char* files[IMAGE_MAX_FILES];
+				u32 addresses[IMAGE_MAX_FILES];
+				u32 nFiles = ParseImageFiles(argc, argv, &n, files, addresses);
+				if (nFiles == 1 && ImageIsStream(files[0]))
 				{
-					const char* pFilename = argv[n];
-					u32 addr = 0;
-
-					if (((n + 1) < argc) && argv[n + 1][0] != '-')
+					// stdin and pipes are written as they arrive
+					u8 format;
+					ImageStream* stream = ImageStreamOpen(files[0], &format);
+					if (stream) session.ProgramStream(stream, addresses[0], param);
+					else if (format == IMAGE_FORMAT_IHEX) printf("Error: Intel HEX can't be streamed, write it from a file.\n");
+					else printf("Error: Unable to open %s.\n", files[0]);
+				}
+				else if (nFiles)
+				{
+					// all files go in one image, so they share the erase, program and verify
+					Image image;
+					bool bLoaded;
 					{
-						n++;
-						addr = StringToNumber(argv[n]);
+						StatScope scope(&session, STAT_OP_IMAGE);
+						bLoaded = LoadImages(&image, files, addresses, nFiles);
+					}
+					if (bLoaded)
+					{
+						session.ProgramImage(&image, param);
+						ImageFree(&image);
 					}
-
-					ConfigProgramHex(pFilename, addr, param);
 				}
 				else
 				{
@@ -982,7 +635,22 @@ int main(int argc, const char **argv)
 		}
 
 		// make sure we leave with all signals inactive
-		ConfigIdle();
-		ConfigTerm();
+		session.Idle();
+		session.Term();
+
+		if (bStats)
+		{
+			StatsPrint(&stats);
+			FILE* f;
+			if (pStatsFile && fopen_s(&f, pStatsFile, "wt") == 0)
+			{
+				StatsWriteJSON(&stats, f);
+				fclose(f);
+			}
+			else if (pStatsFile)
+			{
+				printf("Unable to write %s.\n", pStatsFile);
+			}
+		}
 	}
  }